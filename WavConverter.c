@@ -17,13 +17,31 @@ Requirements:
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <math.h>
 
 #include <dirent.h>
-#include <lame/lame.h>
 #include <getopt.h>
 
 #include "system_shims.h"
 #include "filesystem_access.h"
+#include "thread_pool.h"
+#include "encoder.h"
+#include "worker_buffers.h"
+#include "split_encode.h"
+#include "block_io.h"
+#include "io_pipeline.h"
+#include "pcm_convert.h"
+#include "watch.h"
+#include "path_set.h"
+#include "manifest.h"
+#include "cache.h"
+#include "file_list.h"
+#include "hash.h"
+#include "cpu_info.h"
+#include "tuner.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "report.h"
 
 #define PROGRAM "WavConverter"
 #define VERSION "v0.1"
@@ -34,8 +52,9 @@ Requirements:
 * Configuration defines
 ****************************************************************************************/
 #define DEFAULT_Q_LVL (5)
-#define PCM_SIZE      (8192)
-#define MP3_SIZE      (8192)
+#define DEFAULT_DEPTH (4) // Blocks buffered per file in each direction by the I/O pipeline
+#define WALKER_THREADS (4) // Threads reading directories in --recursive mode
+#define AUTO_CORES_FACTOR (4) // Workers per CPU the concurrency tuner may use with --max-cores auto
 
 enum quality_lvl {
     OPTIMIZE_QUALITY_HIGH = 2,
@@ -43,39 +62,114 @@ enum quality_lvl {
     OPTIMIZE_QUALITY_LOW = 7
 };
 
+enum schedule_policy {
+    SCHEDULE_FIFO,  // Encode in the order files are found
+    SCHEDULE_LPT,   // Longest processing time first, to minimize total batch time
+    SCHEDULE_SJF    // Shortest job first, to minimize time to first output
+};
+
 typedef struct parameters_t {
     filepath input_dir;
     filepath output_dir;
+    int   output_given;
+    char *files_from;                // List of WAVs to encode instead of scanning input_dir, "-" for stdin
+    int   null_separated;
+    int   shard_index;               // Only files whose path hashes to this partition of shard_count are encoded
+    int   shard_count;
 
     int   quality_lvl;
+    float gain;
     int   max_cores;
+    int   max_cores_given;           // -n set max_cores, so --pin leaves it alone
+    int   auto_cores;                // Tune the number of jobs running at once to the throughput
+    int   pin;                       // Pin workers to cores, and to SMT siblings too if pin_smt
+    int   pin_smt;
+    int   split_seconds;
+    int   recursive;
+    int   watch;
+    int   rescan;                    // Only queue WAVs whose MP3 is missing or older, after watch events were lost
+    int   incremental;
+    int   incremental_hash;
+    filepath cache_dir;
+    int   cache_link;
+    enum schedule_policy schedule;
+
+    int   pipeline;
+    int   read_depth;
+    int   write_depth;
+    int   io_uring;
+    int   mmap_input;
+    char *trace_path;                // Chrome trace of the run, or NULL
+    int   perf;                      // Hardware counters per job
+    char *report_path;               // Per-file results as JSON Lines or CSV, or NULL
 } parameters;
 
 typedef struct thread_args_t {
     filepath in_file;
     filepath out_file;
+    long long in_size;
+    source_stamp stamp;              // State of the WAV when it was queued, for the manifest
+    double audio_seconds;            // Length of the WAV, once it is parsed
+    job_report report;               // Only filled in with --report
+    uint64_t pcm_hash;               // Hash of the PCM data taken while encoding, for --incremental=hash
+    bool pcm_hashed;
 
     int quality;
+    float gain;
+    int split_seconds;
+    int mmap_input;
 } thread_args;
 
+//! Jobs held back until the scan completes so they can be ordered by size
+typedef struct job_list_t {
+    thread_args **jobs;
+    size_t count;
+    size_t capacity;
+} job_list;
+
 struct option opts[] = {
     {"help",        no_argument, 0, 'h'},
     {"usage",       no_argument, 0, 'u'},
     {"version",     no_argument, 0, 'v'},
     {"output",      required_argument, 0, 'o'},
     {"quality",     required_argument, 0, 'q'},
+    {"gain",        required_argument, 0, 'G'},
     {"max-cores",   required_argument, 0, 'n'},
+    {"pin",         optional_argument, 0, 'P'},
+    {"split",       required_argument, 0, 's'},
+    {"recursive",   no_argument,       0, 'r'},
+    {"watch",       no_argument,       0, 'w'},
+    {"incremental", optional_argument, 0, 'I'},
+    {"cache",       required_argument, 0, 'C'},
+    {"cache-link",  no_argument,       0, 'L'},
+    {"files-from",  required_argument, 0, 'F'},
+    {"null",        no_argument,       0, '0'},
+    {"shard",       required_argument, 0, 'D'},
+    {"schedule",    required_argument, 0, 'S'},
+    {"pipeline",    no_argument,       0, 'p'},
+    {"read-depth",  required_argument, 0, 'R'},
+    {"write-depth", required_argument, 0, 'W'},
+    {"io-uring",    no_argument,       0, 'U'},
+    {"mmap",        no_argument,       0, 'm'},
+    {"trace",       required_argument, 0, 'T'},
+    {"perf",        no_argument,       0, 'H'},
+    {"report",      required_argument, 0, 'J'},
     {0, 0, 0, 0}
   };
 
-/*! A straight semaphore would be less clear than this struct */
-struct sync_block {
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_var;
-    int counter;
-};
-
-struct sync_block sem = { .counter = 0 };
+thread_pool *pool;
+io_pipeline *io_pipe;
+worker_buffers *buffers;
+manifest *outputs;   // Only with --incremental
+encode_cache *cache; // Only with --cache
+tuner *concurrency;  // Only with --max-cores auto
+cpu_placement *placement; // Only with --pin
+path_set *in_flight; // Inputs with a job queued or running, only with --watch
+char encoder_settings[64]; // Everything besides the WAV format that changes the MP3 a job encodes to
+long shard_seen;           // Files considered and kept by --shard, updated atomically
+long shard_kept;
+job_list pending;
+pthread_mutex_t pending_mutex; // wav_file_found() runs on several walker threads in recursive mode
 char *executable_name;
 
 /*****************************************************************************************
@@ -87,9 +181,21 @@ void version(char *name, char *version, char *license, char *author);
 void parseOpts(parameters *params, int argc, char *argv[]);
 
 /* Misc. function prototypes */
-void encode(FILE *pcm, FILE *mp3, int quality);
-void *convert_wav(void *arg);
+bool transcode(FILE *in_file, const unsigned char *pcm, size_t pcm_len, const wav_header *fmt, FILE *out_file,
+               int quality, float gain, hash_state *digests, int n_digests, int worker_id);
+void convert_wav(void *arg, int worker_id);
+void free_job(thread_args *job);
+void reset_job(thread_args *job);
+void job_done(void *arg, bool ok);
+bool in_shard(const parameters *params, const char *path, size_t len);
+void queue_job(const parameters *params, thread_args *t_params);
 void wav_file_found(filepath dir, filepath file, void *args);
+void listed_file_found(char *in_path, char *out_path, void *args);
+void submit_job(thread_args *job);
+void pin_worker(int worker_id, void *args);
+void submit_pending(enum schedule_policy policy);
+void scan_input(void *args);
+void rescan_input(void *args);
 
 /*****************************************************************************************
  * Parameter parsing
@@ -98,20 +204,43 @@ void usage(void) {
     printf("\
 Usage: %s [OPTION]... [DIR]\n\
 or:  %s [DIR]\n\
+or:  %s [OPTION]... --files-from [FILE|-]\n\
 Convert WAV files to MP3 via LAME\n\
 \n\
 Examples:\n\
 \t%s F:\\MyWavCollection\n\
 \t%s . -o output\n\
 \t%s --quality mid ~/\n\
+\tfind . -name '*.wav' -print0 | %s -0 --files-from -\n\
 Options:\n\
 \t-o, --output    [DIR]\n\
-\t-n, --max-cores [N]\n\
+\t-n, --max-cores [N|auto]\n\
+\t    --pin[=smt]\n\
 \t-q, --quality   [high|mid|low]\n\
+\t    --gain      [DB]\n\
+\t-s, --split     [SECONDS]\n\
+\t-r, --recursive\n\
+\t    --watch\n\
+\t    --incremental[=hash]\n\
+\t    --cache     [DIR]\n\
+\t    --cache-link\n\
+\t    --files-from [FILE|-]\n\
+\t-0, --null\n\
+\t    --shard     [I/N]\n\
+\t    --schedule  [fifo|lpt|sjf]\n\
+\t-p, --pipeline\n\
+\t    --read-depth  [BLOCKS]\n\
+\t    --write-depth [BLOCKS]\n\
+\t    --io-uring\n\
+\t-m, --mmap\n\
+\t    --trace     [FILE]\n\
+\t    --perf\n\
+\t    --report    [FILE]\n\
 \t-v, --version\n\
 \t-h, --help\n\
 \t    --usage\
-\n", executable_name, executable_name, executable_name, executable_name, executable_name);
+\n", executable_name, executable_name, executable_name, executable_name, executable_name, executable_name,
+       executable_name);
 }
 
 void version(char *name, char *version, char *license, char *author) {
@@ -128,7 +257,7 @@ void parseOpts(parameters *params, int argc, char *argv[]) {
     int sync_out_dir = 1;
 
     while(1) {
-        opt = getopt_long(argc, argv, "hvo:q:n:", opts, NULL);
+        opt = getopt_long(argc, argv, "hvo:q:n:s:rpm0", opts, NULL);
         if(opt != -1) {
             switch(opt) {
             case 'h':
@@ -138,6 +267,7 @@ void parseOpts(parameters *params, int argc, char *argv[]) {
                 break;
             case 'v':
                 version(PROGRAM, VERSION, LICENSE, AUTHOR);
+                printf("SIMD kernels: %s\n", pcm_kernel_name());
                 exit(EXIT_SUCCESS);
                 break;
             case 'o':
@@ -145,6 +275,7 @@ void parseOpts(parameters *params, int argc, char *argv[]) {
                 filepath opt_dir = { optarg, strlen(optarg) };
                 params->output_dir = set_path(params->output_dir, opt_dir);
                 sync_out_dir = 0;
+                params->output_given = 1;
                 break;
             }
             case 'q':
@@ -159,13 +290,136 @@ void parseOpts(parameters *params, int argc, char *argv[]) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'G':
+            {
+                char *end;
+                double db = strtod(optarg, &end);
+                if(end == optarg || *end != '\0' || db < -96.0 || db > 96.0) {
+                    puts("Gain must be a number of decibels between -96 and 96");
+                    exit(EXIT_FAILURE);
+                }
+                params->gain = (float)pow(10.0, db / 20.0);
+                break;
+            }
             case 'n':
             {
+                if(strcmp(optarg, "auto") == 0) {
+                    params->auto_cores = 1;
+                    break;
+                }
                 int max_threads = atoi(optarg);
-                if(max_threads && (max_threads < 2*params->max_cores)) // test for sane values
+                params->auto_cores = 0;
+                if(max_threads && (max_threads < 2*params->max_cores)) { // test for sane values
                     params->max_cores = max_threads;
+                    params->max_cores_given = 1;
+                }
                 break;
             }
+            case 'p':
+                params->pipeline = 1;
+                break;
+            case 'r':
+                params->recursive = 1;
+                break;
+            case 'w':
+                if(!watch_supported()) {
+                    puts("--watch needs inotify, which is only available on Linux");
+                    exit(EXIT_FAILURE);
+                }
+                params->watch = 1;
+                break;
+            case 'P':
+                if(optarg != NULL && strcmp(optarg, "smt") != 0) {
+                    puts("Unknown pinning mode");
+                    exit(EXIT_FAILURE);
+                }
+                params->pin = 1;
+                params->pin_smt = (optarg != NULL);
+                break;
+            case 'I':
+                if(optarg != NULL && strcmp(optarg, "hash") != 0) {
+                    puts("Unknown incremental mode");
+                    exit(EXIT_FAILURE);
+                }
+                params->incremental = 1;
+                params->incremental_hash = (optarg != NULL);
+                break;
+            case 'C':
+            {
+                filepath opt_dir = { optarg, strlen(optarg) };
+                params->cache_dir = set_path(params->cache_dir, opt_dir);
+                break;
+            }
+            case 'L':
+                params->cache_link = 1;
+                break;
+            case 'F':
+                params->files_from = optarg;
+                break;
+            case '0':
+                params->null_separated = 1;
+                break;
+            case 'D':
+            {
+                int index, count, end = 0;
+                if(sscanf(optarg, "%d/%d%n", &index, &count, &end) != 2 || optarg[end] != '\0' ||
+                   count < 1 || index < 0 || index >= count) {
+                    puts("Shards are given as I/N, with 0 <= I < N");
+                    exit(EXIT_FAILURE);
+                }
+                params->shard_index = index;
+                params->shard_count = count;
+                break;
+            }
+            case 'm':
+                params->mmap_input = 1;
+                break;
+            case 'T':
+                params->trace_path = optarg;
+                break;
+            case 'H':
+                params->perf = 1;
+                break;
+            case 'J':
+                params->report_path = optarg;
+                break;
+            case 'U':
+                params->io_uring = 1;
+                break;
+            case 'R':
+            case 'W':
+            {
+                int depth = atoi(optarg);
+                if(depth <= 0) {
+                    puts("Queue depths must be at least one block");
+                    exit(EXIT_FAILURE);
+                }
+                if(opt == 'R')
+                    params->read_depth = depth;
+                else
+                    params->write_depth = depth;
+                params->pipeline = 1;
+                break;
+            }
+            case 'S':
+                if(strcmp(optarg, "fifo") == 0)
+                    params->schedule = SCHEDULE_FIFO;
+                else if(strcmp(optarg, "lpt") == 0)
+                    params->schedule = SCHEDULE_LPT;
+                else if(strcmp(optarg, "sjf") == 0)
+                    params->schedule = SCHEDULE_SJF;
+                else {
+                    puts("Unknown schedule");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                params->split_seconds = atoi(optarg);
+                if(params->split_seconds <= 0) {
+                    puts("Split segments must be at least one second long");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '?':
             {
                 int ind = optind - (int)(optopt == 0); // If given unknown short commands (e.g. -abc), optind will remain 
@@ -193,115 +447,466 @@ void parseOpts(parameters *params, int argc, char *argv[]) {
 }
 
 /*****************************************************************************************
-* Encoding Functions
+* Job Functions
 ****************************************************************************************/
-//! Transcode the input WAV into an MP3 file in the output directory
-void encode(FILE *pcm, FILE *mp3, int quality) {
-    int read, write;
+/*! Set up block I/O for a job and encode it. The PCM data comes from pcm if the input is mapped into memory,
+ *  and from in_file otherwise. File I/O goes through the I/O pipeline when it is running, and through the
+ *  worker's arena buffers otherwise.
+ */
+bool transcode(FILE *in_file, const unsigned char *pcm, size_t pcm_len, const wav_header *fmt, FILE *out_file,
+               int quality, float gain, hash_state *digests, int n_digests, int worker_id) {
+    size_t in_block = PCM_SIZE * fmt->block_align;
+    size_t out_block = MP3_BUFFER_BOUND(PCM_SIZE);
+    block_reader *reader = NULL;
+    block_writer *writer = NULL;
+    buffer_arena *arena = NULL;
 
-    wav_header input_params = {0};
-    int ret = parse_wav(&input_params, pcm);
-    
-    if(ret) {
-        puts("Unsupported WAV settings");
-        return;
-    }
-    
-    int sample_size = input_params.bits_per_sample / 8;
-    short int *pcm_buffer = calloc((PCM_SIZE * sample_size) * sizeof(short int), 1);
-    unsigned char *mp3_buffer = calloc(MP3_SIZE * sizeof(unsigned char), 1);
-
-    lame_t lame = lame_init();
-    lame_set_VBR(lame, vbr_default);
-    lame_set_num_channels(lame,input_params.n_channels);
-    lame_set_in_samplerate(lame,input_params.sample_rate);
-    lame_set_out_samplerate(lame, input_params.sample_rate);
-    if(input_params.n_channels == 1)
-        lame_set_mode(lame, 3); // Set encoder to mono
-    lame_set_quality(lame, quality);
-    int lame_success = lame_init_params(lame);
-
-    if((lame_success < 0) || (pcm_buffer == NULL) || (mp3_buffer == NULL)) {
-        puts("Encoder failed to init");
-        return;
+    if(io_pipe == NULL && (arena = worker_arena(buffers, worker_id, PCM_SIZE, fmt->block_align)) == NULL) {
+        puts("Could not allocate memory");
+        return false;
     }
 
-    do {
-        read = fread(pcm_buffer, input_params.n_channels*sizeof(short int), PCM_SIZE, pcm);
-        if (read == 0)
-            write = lame_encode_flush(lame, mp3_buffer, MP3_SIZE);
-        else if(input_params.n_channels == 1)
-            write = lame_encode_buffer(lame, pcm_buffer, NULL, read, mp3_buffer, MP3_SIZE);
-        else 
-            write = lame_encode_buffer_interleaved(lame, pcm_buffer, read, mp3_buffer, MP3_SIZE);
-        fwrite(mp3_buffer, write, 1, mp3);
-    } while (read != 0);
+    stage_begin(STAGE_OPEN);
+    if(pcm != NULL) {
+        reader = open_memory_reader(pcm, pcm_len, in_block);
+        if(io_pipe == NULL)
+            writer = open_stdio_writer(out_file, arena->mp3, arena->mp3_size);
+        else if(!pipeline_open(io_pipe, NULL, 0, out_file, 0, out_block, NULL, &writer))
+            writer = NULL;
+    }
+    else if(io_pipe != NULL) {
+        if(!pipeline_open(io_pipe, in_file, fmt->data_len, out_file, in_block, out_block, &reader, &writer))
+            reader = NULL, writer = NULL;
+    }
+    else {
+        reader = open_stdio_reader(in_file, arena->pcm, in_block, fmt->data_len);
+        writer = open_stdio_writer(out_file, arena->mp3, arena->mp3_size);
+    }
+    stage_end();
 
-    lame_mp3_tags_fid(lame, mp3);
-    lame_close(lame);
+    int32_t *scratch = worker_scratch(buffers, worker_id);
+    lame_t lame = NULL;
+    bool ok = false;
+    if(reader == NULL || writer == NULL || scratch == NULL)
+        puts((io_pipe != NULL && scratch != NULL) ? "Could not register with the I/O pipeline"
+                                                  : "Could not allocate memory");
+    else if((lame = init_encoder(fmt, quality, 0)) == NULL)
+        puts("Encoder failed to init");
+    else {
+        ok = encode(reader, fmt, writer, lame, scratch, gain, digests, n_digests);
+        lame_close(lame);
+    }
 
-    free(pcm_buffer);
-    free(mp3_buffer);
+    if(reader != NULL)
+        reader->close(reader);
+    stage_begin(STAGE_WRITE);
+    if(writer != NULL && !writer->close(writer)) {
+        puts("Could not write MP3 file");
+        ok = false;
+    }
+    stage_end();
+    return ok;
 }
 
-//! Handle the busy-work of running the thread, including modifying the counter mutex and freeing passed arguments
-void *convert_wav(void *arg)
+//! Handle the busy-work of running a job on a pool worker, including freeing passed arguments
+void convert_wav(void *arg, int worker_id)
 {
     thread_args *args = arg;
 
     printf("encoding %s\n", args->out_file.path);
-    FILE *in_file = fopen(args->in_file.path, "rb");
-    FILE *out_file = fopen(args->out_file.path, "wb+");
-    int quality = args->quality;
+    stage_job_begin(worker_id, args->in_file.path);
+    if(perf_active)
+        perf_job_begin(worker_id);
+    if(report_active)
+        report_job_start(&args->report);
+    FILE *in_file = NULL;
+    FILE *out_file = NULL;
+    const unsigned char *mapped = NULL;
+    size_t mapped_len = 0;
+    wav_header input_params = {0};
+    bool parsed = false;
+    bool ok = false;
+    bool split = false;
+    bool cached = false;
+    cache_key key;
+    hash_state digests[2];           // For the cache and the manifest, whichever are in use
+    int n_digests = 0;
 
-    free(args->in_file.path);
-    free(args->out_file.path);
-    free(args);
+    stage_begin(STAGE_OPEN);
+    if(args->mmap_input)
+        mapped = map_file(args->in_file.path, &mapped_len);
+    if(mapped == NULL)
+        in_file = fopen(args->in_file.path, "rb");
+    stage_end();
 
-    if(in_file == NULL || out_file == NULL) {
+    stage_begin(STAGE_PARSE);
+    if(mapped != NULL)
+        parsed = !parse_wav_buffer(&input_params, mapped, mapped_len);
+    else if(in_file != NULL)
+        parsed = !parse_wav(&input_params, in_file);
+    else {
         printf("Could not open files\n");
-        return NULL;
+        args->report.error = "cannot open input";
     }
-    
-    encode(in_file, out_file, quality);
+    stage_end();
 
-    pthread_mutex_lock(&sem.mutex);
-    sem.counter--;
-    pthread_cond_signal(&sem.cond_var);
-    pthread_mutex_unlock(&sem.mutex);
+    if(parsed && input_params.byte_rate > 0)
+        args->audio_seconds = (double)input_params.data_len / input_params.byte_rate;
+    if(parsed)
+        args->report = (job_report) { args->report.start_ns, true, input_params.format_type, input_params.n_channels,
+                                      input_params.bits_per_sample, input_params.sample_rate, false, NULL };
+
+    if((mapped != NULL || in_file != NULL) && !parsed) {
+        puts("Unsupported WAV settings");
+        args->report.error = "unsupported WAV format";
+    }
+    else if(parsed && args->split_seconds &&
+            split_encode(pool, buffers, args->in_file, args->out_file, &input_params, args->quality, args->gain,
+                         args->split_seconds, (split_done) { job_done, args }, worker_id))
+        split = true; // The segment jobs own the output file and args now
+    else if(parsed && cache != NULL &&
+            cache_fetch(cache, &(cache_source) { args->in_file.path,
+                                                 mapped ? &mapped[input_params.data_offset] : NULL,
+                                                 input_params.data_offset, input_params.data_len },
+                        &input_params, encoder_settings, &key, args->out_file.path))
+        ok = cached = args->report.cached = true;
+    else if(parsed) {
+        // Hash the PCM data on its way to the encoder, to store the MP3 in the cache under it, and to record
+        // it in the manifest
+        if(cache != NULL)
+            cache_hash_init(&key, &digests[n_digests++]);
+        if(outputs != NULL && manifest_hashes(outputs))
+            hash_init(&digests[n_digests++], 0);
 
-    fclose(out_file);
-    fclose(in_file);    
-    return NULL;
+        stage_begin(STAGE_OPEN);
+        remove(args->out_file.path); // It may be hard linked to a cache entry, which must not be overwritten
+        out_file = fopen(args->out_file.path, "wb+");
+        stage_end();
+
+        if(out_file == NULL) {
+            printf("Could not open files\n");
+            args->report.error = "cannot open output";
+        }
+        else if(mapped != NULL)
+            ok = transcode(NULL, &mapped[input_params.data_offset], input_params.data_len, &input_params,
+                           out_file, args->quality, args->gain, digests, n_digests, worker_id);
+        else
+            ok = transcode(in_file, NULL, 0, &input_params, out_file, args->quality, args->gain, digests, n_digests,
+                           worker_id);
+    }
+
+    if(out_file != NULL && fclose(out_file) != 0) {
+        ok = false;
+        args->report.error = "cannot write output";
+    }
+    if(ok && cache != NULL && !cached)
+        cache_store(cache, &key, hash_digest(&digests[0]), args->out_file.path);
+    if(ok && !cached && outputs != NULL && manifest_hashes(outputs)) {
+        args->pcm_hash = hash_digest(&digests[n_digests - 1]);
+        args->pcm_hashed = true;
+    }
+    if(in_file != NULL)
+        fclose(in_file);
+    if(mapped != NULL)
+        unmap_file(mapped, mapped_len);
+
+    if(split) { // args belongs to the segment jobs now, which are timed as jobs of their own
+        stage_job_end("split setup");
+        if(perf_active)
+            perf_job_end("split setup", 0);
+    }
+    else {
+        stage_job_end(args->in_file.path);
+        if(perf_active)
+            perf_job_end(args->in_file.path, parsed ? input_params.data_len / MAX(input_params.block_align, 1) : 0);
+        job_done(args, ok);
+    }
+}
+
+void free_job(thread_args *job) {
+    free(job->in_file.path);
+    free(job->out_file.path);
+    free(job);
 }
 
-/*! For every WAV found, spawn a thread to transcode it. If too many threads are currently running, block until we can
- *  safely spawn another.
+//! Forget what a job learnt about its WAV, and take its size afresh, before it is queued
+void reset_job(thread_args *job) {
+    job->stamp = (source_stamp) { 0, 0 };
+    job->audio_seconds = 0;
+    job->report = (job_report) { 0 };
+    job->pcm_hashed = false;
+    job->in_size = f_size(job->in_file.path);
+}
+
+/*! Called once a job's MP3 is closed, on whichever worker finished it. Takes ownership of arg. In watch mode
+ *  a WAV that was written again while its job ran is encoded once more, so the MP3 ends up with its final
+ *  content.
  */
+void job_done(void *arg, bool ok) {
+    thread_args *args = arg;
+
+    if(ok && outputs != NULL)
+        manifest_record(outputs, args->in_file.path, args->out_file.path, &args->stamp,
+                        args->pcm_hashed ? &args->pcm_hash : NULL);
+    if(ok && concurrency != NULL)
+        tuner_record(concurrency, args->audio_seconds);
+    if(report_active)
+        report_job(args->in_file.path, args->out_file.path, &args->report, args->audio_seconds, args->in_size, ok);
+    while(in_flight != NULL && path_set_finish(in_flight, args->in_file.path)) {
+        reset_job(args);
+        if(outputs == NULL ||
+           !manifest_up_to_date(outputs, args->in_file.path, args->out_file.path, &args->stamp)) {
+            submit_job(args);
+            return;
+        }
+    }
+    free_job(args);
+}
+
+//! Hand a job to the worker pool, cleaning up if it cannot be queued
+void submit_job(thread_args *job) {
+    if(!pool_submit(pool, convert_wav, job, POOL_PRIORITY_DEFAULT)) {
+        puts("Could not queue job");
+        if(in_flight != NULL)
+            path_set_remove(in_flight, job->in_file.path);
+        free_job(job);
+    }
+}
+
+//! Runs on each worker before its first job, so everything it allocates lands on its own NUMA node
+void pin_worker(int worker_id, void *args) {
+    if(!placement_apply(args, worker_id))
+        printf("Could not pin worker %d\n", worker_id);
+}
+
+static int longest_first(const void *a, const void *b) {
+    const thread_args *x = *(thread_args * const *)a;
+    const thread_args *y = *(thread_args * const *)b;
+    if(x->in_size != y->in_size)
+        return (x->in_size < y->in_size) ? 1 : -1;
+    return strcmp(x->in_file.path, y->in_file.path); // Keep ties in a reproducible order
+}
+
+static int shortest_first(const void *a, const void *b) {
+    const thread_args *x = *(thread_args * const *)a;
+    const thread_args *y = *(thread_args * const *)b;
+    if(x->in_size != y->in_size)
+        return (x->in_size < y->in_size) ? -1 : 1;
+    return strcmp(x->in_file.path, y->in_file.path);
+}
+
+//! Order the jobs held back during the scan by size and queue them
+void submit_pending(enum schedule_policy policy) {
+    if(pending.count == 0)
+        return;
+
+    qsort(pending.jobs, pending.count, sizeof(thread_args *),
+          (policy == SCHEDULE_SJF) ? shortest_first : longest_first);
+
+    for(size_t i = 0; i < pending.count; i++)
+        submit_job(pending.jobs[i]);
+
+    free(pending.jobs);
+    pending = (job_list) { NULL, 0, 0 };
+}
+
+/*! Whether a file belongs to this process's shard. path is relative to the input dir, or as given in the file
+ *  list, so every host gets the same partition wherever the share is mounted. Separators are hashed as '/'
+ *  to agree between Windows and POSIX hosts.
+ */
+bool in_shard(const parameters *params, const char *path, size_t len) {
+    if(params->shard_count <= 1)
+        return true;
+
+    hash_state state;
+    size_t run = 0;
+    hash_init(&state, 0);
+    for(size_t i = 0; i < len; i++) {
+        if(path[i] == '\\' || path[i] == '/') {
+            hash_update(&state, &path[run], i - run);
+            hash_update(&state, "/", 1);
+            run = i + 1;
+        }
+    }
+    hash_update(&state, &path[run], len - run);
+
+    bool mine = (hash_digest(&state) % (uint64_t)params->shard_count == (uint64_t)params->shard_index);
+    atomic_fetch_add(&shard_seen, 1);
+    if(mine)
+        atomic_fetch_add(&shard_kept, 1);
+    return mine;
+}
+
+/*! Queue a job on the worker pool to transcode t_params->in_file to t_params->out_file. The pool's fixed number
+ *  of workers bounds how many files are encoded at once. Size-ordered schedules hold the job back until the
+ *  scan is done. In incremental mode, files whose MP3 is up to date are dropped here, before a job or encoder
+ *  exists for them.
+ */
+void queue_job(const parameters *params, thread_args *t_params) {
+    t_params->quality = params->quality_lvl;
+    t_params->gain = params->gain;
+    t_params->split_seconds = params->split_seconds;
+    t_params->mmap_input = params->mmap_input;
+
+    if(t_params->in_file.path == NULL || t_params->out_file.path == NULL) {
+        puts("Could not queue job");
+        free_job(t_params);
+        return;
+    }
+    reset_job(t_params);
+
+    if(outputs != NULL &&
+       manifest_up_to_date(outputs, t_params->in_file.path, t_params->out_file.path, &t_params->stamp)) {
+        free_job(t_params);
+        return;
+    }
+
+    source_stamp in, out;
+    if(params->rescan && stat_file(t_params->in_file.path, &in) && stat_file(t_params->out_file.path, &out) &&
+       out.mtime >= in.mtime) {
+        free_job(t_params);
+        return;
+    }
+
+    // Already queued or running: it is marked dirty instead, so its job runs again once done. If the set can't
+    // take the path, the job is queued without it.
+    bool added = true;
+    if(in_flight != NULL && path_set_add(in_flight, t_params->in_file.path, &added) && !added) {
+        free_job(t_params);
+        return;
+    }
+
+    if(params->schedule == SCHEDULE_FIFO) {
+        submit_job(t_params);
+        return;
+    }
+
+    pthread_mutex_lock(&pending_mutex);
+    if(pending.count == pending.capacity) {
+        size_t capacity = MAX(256, 2 * pending.capacity);
+        thread_args **tmp = realloc(pending.jobs, capacity * sizeof(thread_args *));
+        if(tmp == NULL) { // Can't hold it back, so just start it now
+            pthread_mutex_unlock(&pending_mutex);
+            submit_job(t_params);
+            return;
+        }
+        pending.jobs = tmp;
+        pending.capacity = capacity;
+    }
+    pending.jobs[pending.count++] = t_params;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+//! For every WAV found, queue a job to transcode it. Files in subdirectories of the input dir go to the same
+//! subdirectories of the output dir.
 void wav_file_found(filepath dir, filepath file, void *args) {
     parameters params = *(parameters *)args;
 
-    thread_args *t_params = malloc(sizeof(thread_args)); // This will be freed by the child thread
+    if(params.shard_count > 1) {
+        filepath rel = get_full_path((filepath) { &dir.path[params.input_dir.path_len],
+                                                  dir.path_len - params.input_dir.path_len }, file);
+        bool mine = (rel.path != NULL && in_shard(&params, rel.path, rel.path_len));
+        free(rel.path);
+        if(!mine)
+            return;
+    }
+
+    thread_args *t_params = malloc(sizeof(thread_args)); // This will be freed by the worker
     if(t_params == NULL) {
-        puts("Could not start thread");
+        puts("Could not queue job");
         return;
     }
 
     t_params->in_file = get_full_path(dir, file);
 
     memcpy(&file.path[file.path_len-3], "MP3", 3);
-    t_params->out_file = get_full_path(params.output_dir, file);
+    if(dir.path_len > params.input_dir.path_len) {
+        filepath subdir = { &dir.path[params.input_dir.path_len], dir.path_len - params.input_dir.path_len };
+        filepath out_dir = get_full_path(params.output_dir, subdir);
+        if(out_dir.path == NULL || !make_dirs(out_dir))
+            printf("Cannot create directory '%s'\n", out_dir.path ? out_dir.path : subdir.path);
+        t_params->out_file = get_full_path(out_dir, file);
+        free(out_dir.path);
+    }
+    else
+        t_params->out_file = get_full_path(params.output_dir, file);
+
+    queue_job(&params, t_params);
+}
 
-    t_params->quality = params.quality_lvl;
+/*! Queue a job for a WAV named in the --files-from list. Without an MP3 path in the list, the MP3 goes next to
+ *  the WAV, or into the output dir if one was given. Missing directories in front of the MP3 are created.
+ */
+void listed_file_found(char *in_path, char *out_path, void *args) {
+    const parameters *params = args;
 
-    pthread_t tid;
-    pthread_mutex_lock(&sem.mutex);
-    if(sem.counter >= params.max_cores)
-        pthread_cond_wait(&sem.cond_var, &sem.mutex);
+    if(!in_shard(params, in_path, strlen(in_path)))
+        return;
 
-    sem.counter++;
-    pthread_mutex_unlock(&sem.mutex);
-    pthread_create(&tid, NULL, convert_wav, t_params);   
+    thread_args *t_params = malloc(sizeof(thread_args)); // This will be freed by the worker
+    if(t_params == NULL) {
+        puts("Could not queue job");
+        return;
+    }
+    t_params->in_file = get_full_path((filepath) { "", 0 }, (filepath) { in_path, strlen(in_path) });
+
+    if(out_path != NULL)
+        t_params->out_file = get_full_path((filepath) { "", 0 }, (filepath) { out_path, strlen(out_path) });
+    else {
+        size_t dir_len = dir_part_len(in_path);
+        char *name = &in_path[dir_len];
+        char *ext = get_ext(name);
+        int name_len = (int)((ext != NULL) ? (size_t)(ext - name) : strlen(name)); // ".MP3" replaces the extension
+
+        const char *dir = params->output_given ? params->output_dir.path : in_path;
+        int out_dir_len = (int)(params->output_given ? params->output_dir.path_len : dir_len);
+        size_t len = out_dir_len + name_len + 4;
+        t_params->out_file = (filepath) { malloc(len + 1), len };
+        if(t_params->out_file.path != NULL)
+            snprintf(t_params->out_file.path, len + 1, "%.*s%.*s.MP3", out_dir_len, dir, name_len, name);
+    }
+
+    if(t_params->out_file.path != NULL) {
+        size_t out_dir_len = dir_part_len(t_params->out_file.path);
+        if(out_dir_len > 1 && !make_dirs((filepath) { t_params->out_file.path, out_dir_len - 1 }))
+            printf("Cannot create directory for '%s'\n", t_params->out_file.path);
+    }
+
+    queue_job(params, t_params);
+}
+
+//! Queue a job for every WAV in the input dir, in the order of the schedule
+void scan_input(void *args) {
+    parameters *params = args;
+    callback cb = { .func = &wav_file_found,
+                    .args = params };
+
+    if(params->files_from != NULL) {
+        list_callback list_cb = { .func = &listed_file_found,
+                                  .args = params };
+        bool use_stdin = (strcmp(params->files_from, "-") == 0);
+        FILE *list = use_stdin ? stdin : fopen(params->files_from, "rb");
+        if(list == NULL || !read_file_list(list, params->null_separated, list_cb))
+            printf("Could not read file list %s\n", params->files_from);
+        if(list != NULL && !use_stdin)
+            fclose(list);
+    }
+    else if(params->recursive)
+        walk_tree(params->input_dir, ".wav", WALKER_THREADS, cb);
+    else
+        traverse_dir(params->input_dir, ".wav", cb);
+    submit_pending(params->schedule);
+
+    if(params->watch) // Files that arrive later can't wait for a scan to end, so they are encoded in arrival order
+        params->schedule = SCHEDULE_FIFO;
+}
+
+//! Scan the input dir again after watch events were lost, queueing only WAVs that are newer than their MP3
+void rescan_input(void *args) {
+    parameters *params = args;
+    params->rescan = 1;
+    scan_input(params);
+    params->rescan = 0;
 }
 
 /*****************************************************************************************
@@ -310,11 +915,42 @@ void wav_file_found(filepath dir, filepath file, void *args) {
 int main (int argc, char *argv[]) {
     
     executable_name = argv[0];
+    pcm_init(); // Before any worker threads start using the kernels
+
+    const char *cpu_source;
+    int cpus = available_cpus(&cpu_source);
 
     parameters params = { .input_dir   = (filepath) {NULL, 0},
                           .output_dir  = (filepath) {NULL, 0},
+                          .output_given = 0,
+                          .files_from  = NULL,
+                          .null_separated = 0,
+                          .shard_index = 0,
+                          .shard_count = 1,
                           .quality_lvl = OPTIMIZE_QUALITY_MID,
-                          .max_cores   = getNumCPUs() };
+                          .gain        = 1.0f,
+                          .max_cores   = cpus,
+                          .max_cores_given = 0,
+                          .auto_cores  = 0,
+                          .pin         = 0,
+                          .pin_smt     = 0,
+                          .split_seconds = 0,
+                          .recursive   = 0,
+                          .watch       = 0,
+                          .rescan      = 0,
+                          .incremental = 0,
+                          .incremental_hash = 0,
+                          .cache_dir   = (filepath) {NULL, 0},
+                          .cache_link  = 0,
+                          .schedule    = SCHEDULE_FIFO,
+                          .pipeline    = 0,
+                          .read_depth  = DEFAULT_DEPTH,
+                          .write_depth = DEFAULT_DEPTH,
+                          .io_uring    = 0,
+                          .mmap_input  = 0,
+                          .trace_path  = NULL,
+                          .perf        = 0,
+                          .report_path = NULL };
 
     params.input_dir.path = getCwd(NULL, INITIAL_SYS_PATH_LEN); // getcwd() will malloc enough memory. If it cannot, there's no hope anyway.
     params.input_dir.path_len = MAX(strlen(params.input_dir.path), INITIAL_SYS_PATH_LEN); 
@@ -333,9 +969,35 @@ int main (int argc, char *argv[]) {
         
     parseOpts(&params, argc, argv);
 
+    if(params.pin && (placement = placement_create(params.pin_smt)) == NULL)
+        puts("CPU topology is not available, workers are not pinned");
+    if(placement != NULL && !params.max_cores_given && placement_slots(placement) < cpus) {
+        params.max_cores = placement_slots(placement); // One worker per core unless told otherwise
+        cpus = params.max_cores;
+        cpu_source = "physical cores";
+    }
+
+    int workers = params.max_cores;
+    if(params.auto_cores) {
+        workers = AUTO_CORES_FACTOR * params.max_cores; // Room for extra jobs to hide slow I/O
+        printf("Using up to %d worker threads, tuned to throughput starting from %d (%s)\n", workers,
+               params.max_cores, cpu_source);
+    }
+    else if(params.max_cores == cpus)
+        printf("Using %d worker threads (%s)\n", params.max_cores, cpu_source);
+    else
+        printf("Using %d worker threads (--max-cores, %d CPUs by %s)\n", params.max_cores, cpus, cpu_source);
+    if(placement != NULL)
+        placement_report(placement, workers);
+
     params.input_dir = normalize_filepath(params.input_dir);
     params.output_dir = normalize_filepath(params.output_dir);
 
+    if(params.watch && params.files_from != NULL) {
+        puts("--watch and --files-from can't be combined");
+        exit(EXIT_FAILURE);
+    }
+
     int i_exist = f_access(params.input_dir.path, test_existence);
     int o_exist = f_access(params.output_dir.path, test_existence);
 
@@ -347,21 +1009,108 @@ int main (int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    pthread_mutex_init(&sem.mutex, NULL);
-    pthread_cond_init(&sem.cond_var, NULL);
+    if(params.io_uring && (io_pipe = pipeline_create(params.read_depth, params.write_depth, true)) == NULL)
+        puts("io_uring is not available, using stdio");
 
-    callback cb = { .func = &wav_file_found,
-                    .args = &params };
-    traverse_dir(params.input_dir, ".wav", cb);
+    if(params.pipeline && io_pipe == NULL &&
+       (io_pipe = pipeline_create(params.read_depth, params.write_depth, false)) == NULL) {
+        puts("Could not start I/O pipeline");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(encoder_settings, sizeof(encoder_settings), "q%d,g%.6g,v%d", params.quality_lvl, params.gain,
+             ENCODER_VBR_MODE);
+
+    if(params.incremental) {
+        char settings[80]; // Split files differ slightly from ones encoded in one piece
+        snprintf(settings, sizeof(settings), "%s,s%d", encoder_settings, params.split_seconds);
+
+        char name[64]; // Shards share the output dir, so each keeps its own manifest
+        if(params.shard_count > 1)
+            snprintf(name, sizeof(name), "%s.%d-of-%d", MANIFEST_NAME, params.shard_index, params.shard_count);
+        else
+            snprintf(name, sizeof(name), "%s", MANIFEST_NAME);
+
+        if((outputs = manifest_open(params.output_dir, name, settings, params.incremental_hash)) == NULL)
+            puts("Could not open the manifest, encoding everything");
+    }
+
+    if(params.cache_dir.path != NULL) {
+        params.cache_dir = normalize_filepath(params.cache_dir);
+        if((cache = cache_open(params.cache_dir, params.cache_link)) == NULL)
+            exit(EXIT_FAILURE);
+    }
+
+    if(params.trace_path != NULL) {
+        if(!trace_open(params.trace_path))
+            exit(EXIT_FAILURE);
+        trace_thread_name("main");
+    }
+    if(params.report_path != NULL && !report_open(params.report_path))
+        exit(EXIT_FAILURE);
+    if(params.perf && !perf_open(workers))
+        puts("Running without hardware counters");
+    timing_init(workers);
+    buffers = worker_buffers_create(workers);
+    pool = pool_create(workers, (worker_hook) { (placement != NULL) ? pin_worker : NULL, placement });
+    if(buffers == NULL || pool == NULL) {
+        puts("Could not start worker threads");
+        exit(EXIT_FAILURE);
+    }
+    if(params.auto_cores && (concurrency = tuner_create(pool, params.max_cores, workers)) == NULL)
+        puts("Could not start the concurrency tuner, running all workers");
+
+    pthread_mutex_init(&pending_mutex, NULL);
+    if(params.watch) {
+        callback cb = { .func = &wav_file_found,
+                        .args = &params };
+        if((in_flight = path_set_create()) == NULL)
+            puts("Could not track queued files, duplicate events will encode a file twice");
+        if(!watch_dir(params.input_dir, ".wav", params.recursive, scan_input, rescan_input, cb))
+            printf("Could not watch %s\n", params.input_dir.path);
+    }
+    else
+        scan_input(&params);
+    pthread_mutex_destroy(&pending_mutex);
+
+    if(concurrency != NULL) { // The tuner adjusts the pool until the last job is done
+        pool_drain(pool);
+        tuner_destroy(concurrency);
+    }
+    pool_join(pool); // Idle while the workers drain the queue
+    if(placement != NULL)
+        placement_destroy(placement);
+    if(in_flight != NULL)
+        path_set_destroy(in_flight);
 
-    pthread_mutex_lock(&sem.mutex);
-    while(sem.counter > 0) // Idle while the threads do their work
-        pthread_cond_wait(&sem.cond_var, &sem.mutex);
+    timing_report();
+    if(perf_active)
+        perf_close();
+    worker_buffers_destroy(buffers);
 
-    pthread_mutex_unlock(&sem.mutex);
+    if(outputs != NULL) {
+        manifest_report(outputs);
+        manifest_close(outputs);
+    }
+
+    if(cache != NULL) {
+        cache_report(cache);
+        cache_close(cache);
+    }
+
+    if(params.shard_count > 1)
+        printf("Shard %d/%d: %ld of %ld files\n", params.shard_index, params.shard_count,
+               atomic_load_acquire(&shard_kept), atomic_load_acquire(&shard_seen));
+
+    if(io_pipe != NULL) {
+        pipeline_report(io_pipe);
+        pipeline_destroy(io_pipe);
+    }
 
-    pthread_mutex_destroy(&sem.mutex);
-    pthread_cond_destroy(&sem.cond_var);
+    if(trace_active)
+        trace_close();
+    if(report_active)
+        report_close();
 
     // The OS will deallocate params.input_dir.path and params.output_dir.path automatically
     // On bare-metal embedded systems they should be deallocated for sanitation reasons
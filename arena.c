@@ -0,0 +1,56 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+    #include <malloc.h>
+#endif
+
+#include "encoder.h"
+#include "arena.h"
+
+static void *aligned_alloc_buffer(size_t size) {
+#if defined(_WIN32)
+    return _aligned_malloc(size, ARENA_ALIGNMENT);
+#else
+    void *p;
+    return (posix_memalign(&p, ARENA_ALIGNMENT, size) == 0) ? p : NULL;
+#endif
+}
+
+static void aligned_free_buffer(void *p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+//! Grow *buffer to at least size bytes, rounded up to whole alignment units
+static bool grow(unsigned char **buffer, size_t *capacity, size_t size) {
+    if(*capacity >= size)
+        return true;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    unsigned char *tmp = aligned_alloc_buffer(size);
+    if(tmp == NULL)
+        return false;
+
+    aligned_free_buffer(*buffer);
+    *buffer = tmp;
+    *capacity = size;
+    return true;
+}
+
+bool arena_reserve(buffer_arena *arena, int frames, int block_align) {
+    return grow(&arena->pcm, &arena->pcm_size, (size_t)frames * block_align) &&
+           grow(&arena->mp3, &arena->mp3_size, MP3_BUFFER_BOUND((size_t)frames));
+}
+
+void arena_free(buffer_arena *arena) {
+    aligned_free_buffer(arena->pcm);
+    aligned_free_buffer(arena->mp3);
+    arena->pcm = arena->mp3 = NULL;
+    arena->pcm_size = arena->mp3_size = 0;
+}
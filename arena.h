@@ -0,0 +1,29 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Reusable PCM and MP3 buffers for one worker. They grow to the largest chunk the worker has encoded and
+ * are kept until exit, so jobs don't allocate their I/O buffers. The MP3 buffer is sized with LAME's
+ * worst-case bound for the chunk length, so any chunk that fits the PCM buffer can be encoded in one call.
+ * Both buffers are aligned for the widest vector loads the PCM kernels use.
+ */
+#define ARENA_ALIGNMENT (64)
+
+typedef struct buffer_arena_t {
+    unsigned char *pcm;
+    size_t pcm_size;
+    unsigned char *mp3;
+    size_t mp3_size;
+} buffer_arena;
+
+//! Make sure the arena holds frames frames of block_align bytes each, and the MP3 data LAME can produce
+//! for them. Existing contents are not preserved. Returns false if memory runs out.
+bool arena_reserve(buffer_arena *arena, int frames, int block_align);
+
+//! Free the arena's buffers
+void arena_free(buffer_arena *arena);
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,279 @@
+/*
+ * Deterministic synthetic WAV corpus for the benchmark. Every sample is computed with integer arithmetic
+ * from a fixed seed, so the corpus is bit-identical on every machine and in every run. It mixes many short
+ * clips in every sample format the converter accepts with a few long files that exercise the streaming and
+ * split paths.
+ *
+ * Usage: gen_corpus DIR [SCALE]
+ *
+ * SCALE multiplies the number of clips and the length of the long files, 1 by default. The corpus is only
+ * regenerated if DIR/corpus.info is missing or was written for another scale or corpus version. The totals
+ * the benchmark runner needs are written to corpus.info.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define CORPUS_VERSION (1)
+#define CORPUS_SEED    (0x5741563250334D42ULL)
+#define CLIPS          (400)    // Short clips at scale 1
+#define CLIP_MIN_MS    (500)
+#define CLIP_MAX_MS    (8000)
+#define LONG_SECONDS   (600)    // Length of each long file at scale 1
+#define BLOCK_FRAMES   (65536)
+
+#define WAVE_FORMAT_PCM        (1)
+#define WAVE_FORMAT_IEEE_FLOAT (3)
+
+typedef struct sample_format_t {
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bits;
+    uint16_t format_type;
+} sample_format;
+
+static const uint32_t rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000 };
+static const uint16_t depths[][2] = { { 16, WAVE_FORMAT_PCM }, { 24, WAVE_FORMAT_PCM }, { 32, WAVE_FORMAT_PCM },
+                                      { 32, WAVE_FORMAT_IEEE_FLOAT } };
+
+static const sample_format long_files[] = { { 44100, 2, 16, WAVE_FORMAT_PCM },
+                                            { 48000, 2, 24, WAVE_FORMAT_PCM },
+                                            { 22050, 1, 32, WAVE_FORMAT_IEEE_FLOAT } };
+
+typedef struct corpus_totals_t {
+    long files;
+    double audio_seconds;
+    long long bytes;
+} corpus_totals;
+
+/*****************************************************************************************
+* Signal
+****************************************************************************************/
+//! xorshift64*, so the corpus doesn't depend on the C library's rand()
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t random_below(uint64_t *state, uint32_t n) {
+    return (uint32_t)((next_random(state) >> 32) % n);
+}
+
+//! Three triangle oscillators and some low-passed noise per channel
+typedef struct synth_t {
+    uint32_t phase[2][3];
+    uint32_t step[2][3];
+    int64_t noise[2];
+    uint64_t random;
+} synth;
+
+static void synth_init(synth *s, uint64_t *random, uint32_t sample_rate) {
+    memset(s, 0, sizeof(synth));
+    s->random = next_random(random) | 1;
+    for(int c = 0; c < 2; c++) {
+        for(int o = 0; o < 3; o++) {
+            uint64_t millihertz = 55000 + random_below(random, 1700000); // 55 Hz to 1.7 kHz
+            s->step[c][o] = (uint32_t)((millihertz << 32) / (1000ULL * sample_rate));
+        }
+    }
+}
+
+static int32_t triangle(uint32_t phase) {
+    uint32_t q = (phase & 0x80000000u) ? ~phase : phase;
+    return (int32_t)((int64_t)q * 2 - 0x80000000LL);
+}
+
+//! Next sample of channel c, full scale 32-bit
+static int32_t synth_next(synth *s, int c) {
+    int64_t mix = 0;
+    for(int o = 0; o < 3; o++) {
+        mix += triangle(s->phase[c][o]) / 4;
+        s->phase[c][o] += s->step[c][o];
+    }
+    int64_t white = (int64_t)(int32_t)(next_random(&s->random) >> 32);
+    s->noise[c] += (white - s->noise[c]) / 8;
+    mix += s->noise[c] / 8;
+    return (int32_t)((mix > INT32_MAX) ? INT32_MAX : (mix < INT32_MIN) ? INT32_MIN : mix);
+}
+
+static void put_le16(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    put_le16(p, v & 0xFFFF);
+    put_le16(&p[2], v >> 16);
+}
+
+//! Store a full scale sample in the file's format
+static unsigned char *put_sample(unsigned char *p, int32_t v, const sample_format *fmt) {
+    if(fmt->format_type == WAVE_FORMAT_IEEE_FLOAT) {
+        float f = (float)v / 2147483648.0f;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        put_le32(p, bits);
+        return p + 4;
+    }
+    switch(fmt->bits) {
+    case 16:
+        put_le16(p, (uint32_t)(v >> 16));
+        return p + 2;
+    case 24:
+        put_le16(p, (uint32_t)(v >> 8));
+        p[2] = (unsigned char)(v >> 24);
+        return p + 3;
+    default:
+        put_le32(p, (uint32_t)v);
+        return p + 4;
+    }
+}
+
+/*****************************************************************************************
+* Files
+****************************************************************************************/
+//! Write a canonical 44-byte header WAV of frames frames. Returns false on I/O errors.
+static bool write_wav(const char *path, const sample_format *fmt, uint64_t *random, uint32_t frames) {
+    uint32_t block_align = fmt->channels * fmt->bits / 8;
+    uint32_t data_len = frames * block_align;
+    unsigned char header[44];
+
+    memcpy(header, "RIFF", 4);
+    put_le32(&header[4], 36 + data_len);
+    memcpy(&header[8], "WAVEfmt ", 8);
+    put_le32(&header[16], 16);
+    put_le16(&header[20], fmt->format_type);
+    put_le16(&header[22], fmt->channels);
+    put_le32(&header[24], fmt->sample_rate);
+    put_le32(&header[28], fmt->sample_rate * block_align);
+    put_le16(&header[32], block_align);
+    put_le16(&header[34], fmt->bits);
+    memcpy(&header[36], "data", 4);
+    put_le32(&header[40], data_len);
+
+    FILE *file = fopen(path, "wb");
+    unsigned char *block = malloc((size_t)BLOCK_FRAMES * block_align);
+    bool ok = (file != NULL && block != NULL && fwrite(header, 1, sizeof(header), file) == sizeof(header));
+    synth s;
+    synth_init(&s, random, fmt->sample_rate);
+
+    while(ok && frames > 0) {
+        uint32_t n = (frames < BLOCK_FRAMES) ? frames : BLOCK_FRAMES;
+        unsigned char *p = block;
+        for(uint32_t i = 0; i < n; i++) {
+            for(int c = 0; c < fmt->channels; c++)
+                p = put_sample(p, synth_next(&s, c), fmt);
+        }
+        ok = (fwrite(block, 1, (size_t)(p - block), file) == (size_t)(p - block));
+        frames -= n;
+    }
+
+    if(file != NULL && fclose(file) != 0)
+        ok = false;
+    free(block);
+    if(!ok)
+        printf("Could not write %s\n", path);
+    return ok;
+}
+
+static bool add_file(const char *dir, const char *name, const sample_format *fmt, uint64_t *random,
+                     double seconds, corpus_totals *totals) {
+    char path[4096];
+    double max_frames = (double)(UINT32_MAX - 36) / (fmt->channels * fmt->bits / 8); // RIFF sizes are 32-bit
+    uint32_t frames = (uint32_t)((seconds * fmt->sample_rate < max_frames) ? seconds * fmt->sample_rate : max_frames);
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if(!write_wav(path, fmt, random, frames))
+        return false;
+
+    totals->files++;
+    totals->audio_seconds += (double)frames / fmt->sample_rate;
+    totals->bytes += 44 + (long long)frames * fmt->channels * fmt->bits / 8;
+    return true;
+}
+
+//! Whether DIR already holds the corpus for this scale
+static bool up_to_date(const char *info_path, double scale) {
+    FILE *info = fopen(info_path, "r");
+    int version = 0;
+    double old_scale = -1;
+    if(info == NULL)
+        return false;
+    bool ok = (fscanf(info, "version %d scale %lf", &version, &old_scale) == 2);
+    fclose(info);
+    return ok && version == CORPUS_VERSION && old_scale == scale;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argc > 3) {
+        printf("Usage: %s DIR [SCALE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *dir = argv[1];
+    double scale = (argc == 3) ? strtod(argv[2], NULL) : 1.0;
+    if(scale <= 0) {
+        puts("The scale must be a positive number");
+        return EXIT_FAILURE;
+    }
+
+    char info_path[4096];
+    snprintf(info_path, sizeof(info_path), "%s/corpus.info", dir);
+    if(up_to_date(info_path, scale)) {
+        printf("Corpus in %s is up to date\n", dir);
+        return EXIT_SUCCESS;
+    }
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        printf("Cannot create %s\n", dir);
+        return EXIT_FAILURE;
+    }
+    remove(info_path); // Only a complete corpus gets one
+
+    uint64_t random = CORPUS_SEED;
+    corpus_totals totals = { 0, 0, 0 };
+    char name[64];
+    bool ok = true;
+
+    int clips = (int)(CLIPS * scale + 0.5);
+    for(int i = 0; ok && i < ((clips > 0) ? clips : 1); i++) {
+        sample_format fmt = { rates[random_below(&random, sizeof(rates) / sizeof(rates[0]))],
+                              (uint16_t)(1 + random_below(&random, 2)), 0, 0 };
+        uint32_t depth = random_below(&random, sizeof(depths) / sizeof(depths[0]));
+        fmt.bits = depths[depth][0];
+        fmt.format_type = depths[depth][1];
+        double seconds = (CLIP_MIN_MS + random_below(&random, CLIP_MAX_MS - CLIP_MIN_MS)) / 1000.0;
+
+        snprintf(name, sizeof(name), "clip_%04d_%u_%u%s_%u.wav", i, (unsigned)fmt.sample_rate, (unsigned)fmt.bits,
+                 (fmt.format_type == WAVE_FORMAT_IEEE_FLOAT) ? "f" : "", (unsigned)fmt.channels);
+        ok = add_file(dir, name, &fmt, &random, seconds, &totals);
+    }
+
+    for(size_t i = 0; ok && i < sizeof(long_files) / sizeof(long_files[0]); i++) {
+        const sample_format *fmt = &long_files[i];
+        snprintf(name, sizeof(name), "long_%d_%u_%u%s_%u.wav", (int)i, (unsigned)fmt->sample_rate,
+                 (unsigned)fmt->bits, (fmt->format_type == WAVE_FORMAT_IEEE_FLOAT) ? "f" : "",
+                 (unsigned)fmt->channels);
+        ok = add_file(dir, name, fmt, &random, LONG_SECONDS * scale, &totals);
+    }
+
+    FILE *info = ok ? fopen(info_path, "w") : NULL;
+    if(info == NULL)
+        return EXIT_FAILURE;
+    fprintf(info, "version %d scale %.17g\nfiles %ld\naudio_seconds %.3f\nbytes %lld\n", CORPUS_VERSION, scale,
+            totals.files, totals.audio_seconds, totals.bytes);
+    if(fclose(info) != 0)
+        return EXIT_FAILURE;
+
+    printf("Generated %ld files, %.1f seconds of audio, %lld bytes in %s\n", totals.files, totals.audio_seconds,
+           totals.bytes, dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*
+ * Benchmark runner. Converts a corpus made by gen_corpus once with the given converter and prints one JSON
+ * object with the throughput and resource use of the run on stdout, so results can be collected by scripts
+ * and compared across commits and machines. The converter's own output goes to DIR.log.
+ *
+ * Usage: run_bench DIR CONVERTER [ARGS]...
+ *
+ * The MP3s are written to DIR.out, which is emptied first. ARGS are passed on to the converter.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define PATH_LEN (4096)
+
+typedef struct corpus_info_t {
+    long files;
+    double audio_seconds;
+    long long bytes;
+} corpus_info;
+
+static bool read_info(const char *dir, corpus_info *info) {
+    char path[PATH_LEN];
+    int version;
+    double scale;
+    snprintf(path, sizeof(path), "%s/corpus.info", dir);
+
+    FILE *file = fopen(path, "r");
+    if(file == NULL)
+        return false;
+    bool ok = (fscanf(file, "version %d scale %lf files %ld audio_seconds %lf bytes %lld", &version, &scale,
+                      &info->files, &info->audio_seconds, &info->bytes) == 5);
+    fclose(file);
+    return ok;
+}
+
+//! Remove the MP3s of earlier runs from dir, or create it. Returns false if it can't be used.
+static bool empty_dir(const char *dir) {
+    if(mkdir(dir, 0777) == 0)
+        return true;
+    if(errno != EEXIST)
+        return false;
+
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[2 * PATH_LEN];
+    if(d == NULL)
+        return false;
+    while((entry = readdir(d)) != NULL) {
+        if(entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        remove(path);
+    }
+    closedir(d);
+    return true;
+}
+
+//! Number of non-empty MP3s the run left in dir
+static long count_outputs(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    struct stat st;
+    char path[2 * PATH_LEN];
+    long count = 0;
+    if(d == NULL)
+        return 0;
+    while((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if(len < 4 || strcasecmp(&entry->d_name[len - 4], ".mp3") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        count += (stat(path, &st) == 0 && st.st_size > 0);
+    }
+    closedir(d);
+    return count;
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv) {
+    return (double)tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        printf("Usage: %s DIR CONVERTER [ARGS]...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *dir = argv[1];
+    corpus_info info;
+    if(!read_info(dir, &info)) {
+        printf("No corpus in %s, run gen_corpus first\n", dir);
+        return EXIT_FAILURE;
+    }
+
+    char out_dir[PATH_LEN], log_path[PATH_LEN];
+    snprintf(out_dir, sizeof(out_dir), "%s.out", dir);
+    snprintf(log_path, sizeof(log_path), "%s.log", dir);
+    if(!empty_dir(out_dir)) {
+        printf("Cannot use %s\n", out_dir);
+        return EXIT_FAILURE;
+    }
+
+    // CONVERTER DIR -o DIR.out ARGS...
+    char **args = calloc(argc + 2, sizeof(char *));
+    if(args == NULL)
+        return EXIT_FAILURE;
+    args[0] = argv[2];
+    args[1] = (char *)dir;
+    args[2] = "-o";
+    args[3] = out_dir;
+    for(int i = 3; i < argc; i++)
+        args[i + 1] = argv[i];
+
+    fflush(stdout);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        int log = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        execv(args[0], args);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    if(pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+        printf("Could not run %s\n", args[0]);
+        return EXIT_FAILURE;
+    }
+    double wall = seconds_since(&start);
+    int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    long encoded = count_outputs(out_dir);
+
+    printf("{\"converter\":\"%s\",\"files\":%ld,\"files_encoded\":%ld,\"audio_seconds\":%.3f,\"input_bytes\":%lld,"
+           "\"wall_seconds\":%.3f,\"files_per_second\":%.3f,\"audio_seconds_per_second\":%.3f,"
+           "\"realtime_factor\":%.6f,\"user_seconds\":%.3f,\"system_seconds\":%.3f,\"peak_rss_kib\":%ld,"
+           "\"exit_status\":%d}\n",
+           args[0], info.files, encoded, info.audio_seconds, info.bytes, wall, encoded / wall,
+           info.audio_seconds / wall, wall / info.audio_seconds, timeval_seconds(usage.ru_utime),
+           timeval_seconds(usage.ru_stime), usage.ru_maxrss, exit_status);
+    free(args);
+    return (exit_status == 0 && encoded == info.files) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "system_shims.h"
+#include "block_io.h"
+
+typedef struct stdio_reader_t {
+    block_reader base;
+    FILE *file;
+    unsigned char *buffer;
+    size_t block_size;
+    long long remaining;
+} stdio_reader;
+
+typedef struct memory_reader_t {
+    block_reader base;
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    size_t block_size;
+} memory_reader;
+
+typedef struct stdio_writer_t {
+    block_writer base;
+    FILE *file;
+    unsigned char *buffer;
+    size_t capacity;
+    bool failed;
+} stdio_writer;
+
+/*****************************************************************************************
+* stdio reader
+****************************************************************************************/
+static size_t stdio_next(block_reader *reader, const unsigned char **block) {
+    stdio_reader *r = (stdio_reader *)reader;
+
+    size_t len = fread(r->buffer, 1, (size_t)MIN((long long)r->block_size, r->remaining), r->file);
+
+    *block = r->buffer;
+    r->remaining -= len;
+    return len;
+}
+
+static bool stdio_failed(block_reader *reader) {
+    return ferror(((stdio_reader *)reader)->file) != 0;
+}
+
+static void stdio_reader_close(block_reader *reader) {
+    stdio_reader *r = (stdio_reader *)reader;
+
+    free(r);
+}
+
+block_reader *open_stdio_reader(FILE *file, unsigned char *buffer, size_t block_size, long long len) {
+    stdio_reader *r = malloc(sizeof(stdio_reader));
+    if(r == NULL)
+        return NULL;
+
+    r->base.next = stdio_next;
+    r->base.failed = stdio_failed;
+    r->base.close = stdio_reader_close;
+    r->file = file;
+    r->buffer = buffer;
+    r->block_size = block_size;
+    r->remaining = len;
+    return &r->base;
+}
+
+/*****************************************************************************************
+* Memory reader
+****************************************************************************************/
+static size_t memory_next(block_reader *reader, const unsigned char **block) {
+    memory_reader *r = (memory_reader *)reader;
+    size_t len = (r->len - r->pos < r->block_size) ? r->len - r->pos : r->block_size;
+
+    *block = &r->data[r->pos];
+    r->pos += len;
+    return len;
+}
+
+static bool memory_failed(block_reader *reader) {
+    (void)reader;
+    return false;
+}
+
+static void memory_reader_close(block_reader *reader) {
+    free(reader);
+}
+
+block_reader *open_memory_reader(const unsigned char *data, size_t len, size_t block_size) {
+    memory_reader *r = malloc(sizeof(memory_reader));
+    if(r == NULL)
+        return NULL;
+
+    r->base.next = memory_next;
+    r->base.failed = memory_failed;
+    r->base.close = memory_reader_close;
+    r->data = data;
+    r->len = len;
+    r->pos = 0;
+    r->block_size = block_size;
+    return &r->base;
+}
+
+#if defined(_WIN32)
+const unsigned char *map_file(const char *path, size_t *len) {
+    LARGE_INTEGER size;
+    const unsigned char *data = NULL;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if(GetFileSizeEx(file, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= (size_t)-1) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping != NULL) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0); // The view keeps the mapping alive
+            CloseHandle(mapping);
+            *len = (size_t)size.QuadPart;
+        }
+    }
+    CloseHandle(file);
+    return data;
+}
+
+void unmap_file(const unsigned char *data, size_t len) {
+    UnmapViewOfFile(data);
+}
+#else
+const unsigned char *map_file(const char *path, size_t *len) {
+    struct stat st;
+    void *data = MAP_FAILED;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+
+    if(fstat(fd, &st) == 0 && st.st_size > 0 && (unsigned long long)st.st_size <= (size_t)-1) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL); // Aggressive read-ahead, early page reclaim
+            *len = st.st_size;
+        }
+    }
+    close(fd); // The mapping keeps the file referenced
+    return (data != MAP_FAILED) ? data : NULL;
+}
+
+void unmap_file(const unsigned char *data, size_t len) {
+    munmap((void *)data, len);
+}
+#endif
+
+/*****************************************************************************************
+* stdio writer
+****************************************************************************************/
+static unsigned char *stdio_reserve(block_writer *writer, size_t capacity) {
+    stdio_writer *w = (stdio_writer *)writer;
+
+    return (capacity <= w->capacity) ? w->buffer : NULL;
+}
+
+static bool stdio_commit(block_writer *writer, size_t len) {
+    stdio_writer *w = (stdio_writer *)writer;
+
+    if(len > 0 && fwrite(w->buffer, len, 1, w->file) != 1)
+        w->failed = true;
+    return !w->failed;
+}
+
+static bool stdio_write_at(block_writer *writer, long offset, const unsigned char *data, size_t len) {
+    stdio_writer *w = (stdio_writer *)writer;
+
+    if(fseek(w->file, offset, SEEK_SET) != 0 || fwrite(data, len, 1, w->file) != 1)
+        w->failed = true;
+    fseek(w->file, 0, SEEK_END);
+    return !w->failed;
+}
+
+static bool stdio_writer_close(block_writer *writer) {
+    stdio_writer *w = (stdio_writer *)writer;
+    bool ok = !w->failed;
+
+    free(w);
+    return ok;
+}
+
+block_writer *open_stdio_writer(FILE *file, unsigned char *buffer, size_t capacity) {
+    stdio_writer *w = calloc(1, sizeof(stdio_writer));
+    if(w == NULL)
+        return NULL;
+
+    w->base.reserve = stdio_reserve;
+    w->base.commit = stdio_commit;
+    w->base.write_at = stdio_write_at;
+    w->base.close = stdio_writer_close;
+    w->file = file;
+    w->buffer = buffer;
+    w->capacity = capacity;
+    return &w->base;
+}
@@ -0,0 +1,57 @@
+#ifndef BLOCK_IO_H_
+#define BLOCK_IO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Block-oriented input and output for the encoder, so that encode() doesn't need to know whether data
+ * moves through stdio on the encoding thread or through a separate I/O backend.
+ */
+typedef struct block_reader_t {
+    //! Point *block at the next block of input. The block stays valid until the next call.
+    //! Returns its length in bytes, or 0 at end of file.
+    size_t (*next)(struct block_reader_t *reader, const unsigned char **block);
+
+    //! Whether the input ended early because a read failed. Meaningful once next() has returned 0.
+    bool (*failed)(struct block_reader_t *reader);
+
+    //! Stop reading and free the reader. The underlying file is left open.
+    void (*close)(struct block_reader_t *reader);
+} block_reader;
+
+typedef struct block_writer_t {
+    //! Buffer of at least capacity bytes to encode the next block of output into
+    unsigned char *(*reserve)(struct block_writer_t *writer, size_t capacity);
+
+    //! Queue the first len bytes of the reserved buffer for writing. Returns false once a write has failed.
+    bool (*commit)(struct block_writer_t *writer, size_t len);
+
+    //! Overwrite len bytes at offset once every committed block has been written. Used for the VBR tag.
+    bool (*write_at)(struct block_writer_t *writer, long offset, const unsigned char *data, size_t len);
+
+    //! Wait for all committed blocks to be written and free the writer. The underlying file is left open.
+    //! Returns false if any write failed.
+    bool (*close)(struct block_writer_t *writer);
+} block_writer;
+
+//! Read blocks of block_size bytes into buffer with fread on the calling thread, stopping after len bytes.
+//! The buffer belongs to the caller and must outlive the reader.
+block_reader *open_stdio_reader(FILE *file, unsigned char *buffer, size_t block_size, long long len);
+
+//! Write blocks of up to capacity bytes from buffer with fwrite on the calling thread. The buffer belongs to
+//! the caller and must outlive the writer.
+block_writer *open_stdio_writer(FILE *file, unsigned char *buffer, size_t capacity);
+
+//! Hand out blocks of block_size bytes pointing straight into data, without copying. The memory must
+//! outlive the reader.
+block_reader *open_memory_reader(const unsigned char *data, size_t len, size_t block_size);
+
+//! Map a whole file read-only for sequential access. Returns NULL if it cannot be mapped.
+const unsigned char *map_file(const char *path, size_t *len);
+
+//! Release a mapping made by map_file
+void unmap_file(const unsigned char *data, size_t len);
+
+#endif /* BLOCK_IO_H_ */
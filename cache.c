@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <lame/lame.h>
+
+#include "system_shims.h"
+#include "cache.h"
+
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+#endif
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define COPY_BLOCK (256 * 1024)
+
+struct encode_cache_t {
+    filepath dir;                    // With a trailing separator
+    bool hardlink;
+
+    long hits;                       // Updated atomically
+    long misses;
+    long stored;
+    long wasted;                     // Whole files hashed up front because of a probe match, for nothing
+    long serial;                     // Makes temporary file names unique
+};
+
+/*****************************************************************************************
+* File helpers
+****************************************************************************************/
+//! Create to as a copy-on-write clone of from, on filesystems that support it
+static bool clone_file(const char *from, const char *to) {
+#if defined(__linux__) && defined(FICLONE)
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if(in < 0)
+        return false;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    bool ok = (out >= 0 && ioctl(out, FICLONE, in) == 0);
+
+    if(out >= 0 && close(out) != 0)
+        ok = false;
+    close(in);
+    if(!ok && out >= 0)
+        remove(to);
+    return ok;
+#else
+    (void)from;
+    (void)to;
+    return false;
+#endif
+}
+
+static bool copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    FILE *out = (in != NULL) ? fopen(to, "wb") : NULL;
+    unsigned char *block = malloc(COPY_BLOCK);
+    bool ok = (in != NULL && out != NULL && block != NULL);
+    size_t len;
+
+    while(ok && (len = fread(block, 1, COPY_BLOCK, in)) > 0)
+        ok = (fwrite(block, 1, len, out) == len);
+    if(ok && ferror(in))
+        ok = false;
+
+    if(out != NULL && fclose(out) != 0)
+        ok = false;
+    if(in != NULL)
+        fclose(in);
+    free(block);
+    if(!ok && out != NULL)
+        remove(to);
+    return ok;
+}
+
+//! Replace to with a hard link to, a clone of or a copy of from, in that order of preference
+static bool place_file(const char *from, const char *to, bool hardlink) {
+    remove(to); // Never write through an existing file, it may be linked to a cache entry
+    if(hardlink && make_link(from, to) == 0)
+        return true;
+    return clone_file(from, to) || copy_file(from, to);
+}
+
+/*****************************************************************************************
+* Hashing
+****************************************************************************************/
+//! Bytes of PCM data the encoder will actually get, which is less than src->len for truncated files
+static long long available(const cache_source *src) {
+    if(src->pcm != NULL)
+        return src->len;
+    long long size = f_size(src->path);
+    return MAX(0, MIN(src->len, size - src->offset));
+}
+
+//! Feed the first len bytes of the PCM data to digest. Returns false if they can't be read.
+static bool hash_source(const cache_source *src, long long len, hash_state *digest) {
+    if(src->pcm != NULL) {
+        hash_update(digest, src->pcm, (size_t)len);
+        return true;
+    }
+
+    FILE *file = fopen(src->path, "rb");
+    unsigned char *block = malloc(COPY_BLOCK);
+    bool ok = (file != NULL && block != NULL && fseek(file, (long)src->offset, SEEK_SET) == 0);
+    size_t read;
+
+    while(ok && len > 0 && (read = fread(block, 1, (size_t)MIN(len, COPY_BLOCK), file)) > 0) {
+        hash_update(digest, block, read);
+        len -= (long long)read;
+    }
+    if(ok && (len > 0 || ferror(file)))
+        ok = false;
+
+    if(file != NULL)
+        fclose(file);
+    free(block);
+    return ok;
+}
+
+//! Directory of the entries with the given probe, with a trailing separator
+static filepath probe_dir(encode_cache *c, uint64_t probe) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)probe);
+    return normalize_filepath(get_full_path(c->dir, (filepath) { name, strlen(name) }));
+}
+
+static filepath entry_path(filepath dir, uint64_t digest) {
+    char name[21];
+    snprintf(name, sizeof(name), "%016llx.mp3", (unsigned long long)digest);
+    return get_full_path(dir, (filepath) { name, strlen(name) });
+}
+
+/*****************************************************************************************
+* Cache
+****************************************************************************************/
+encode_cache *cache_open(filepath dir, bool hardlink) {
+    encode_cache *c = calloc(1, sizeof(encode_cache));
+    if(c == NULL)
+        return NULL;
+
+    c->dir.path = strdup(dir.path);
+    c->dir.path_len = (c->dir.path != NULL) ? strlen(c->dir.path) : 0;
+    c->hardlink = hardlink;
+    if(c->dir.path == NULL || !make_dirs(c->dir)) {
+        printf("Cannot create cache dir %s\n", dir.path);
+        cache_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+bool cache_fetch(encode_cache *c, const cache_source *src, const wav_header *fmt, const char *settings,
+                 cache_key *key, const char *out_path) {
+    char id[256];
+    snprintf(id, sizeof(id), "%s|%u,%u,%u,%u,%u|%s", settings, fmt->format_type, fmt->bits_per_sample,
+             fmt->valid_bits, fmt->n_channels, fmt->sample_rate, get_lame_version());
+    key->seed = hash_buffer(id, strlen(id), 0);
+
+    // The probe covers the length as well, so files that only share a beginning tell apart cheaply
+    long long len = available(src);
+    unsigned char len_bytes[8];
+    for(int i = 0; i < 8; i++)
+        len_bytes[i] = (unsigned char)((unsigned long long)len >> (8 * i));
+
+    hash_state state;
+    hash_init(&state, key->seed);
+    hash_update(&state, len_bytes, sizeof(len_bytes));
+    bool ok = hash_source(src, MIN(len, CACHE_PROBE_BYTES), &state);
+    key->probe = hash_digest(&state);
+
+    filepath dir = ok ? probe_dir(c, key->probe) : (filepath) { NULL, 0 };
+    ok = (dir.path != NULL && f_access(dir.path, test_existence) == 0);
+
+    // Something with the same start was cached, so it's worth reading the whole file before encoding it
+    bool hit = false;
+    if(ok) {
+        cache_hash_init(key, &state);
+        if(hash_source(src, len, &state)) {
+            filepath entry = entry_path(dir, hash_digest(&state));
+            hit = (entry.path != NULL && f_access(entry.path, test_existence) == 0 &&
+                   place_file(entry.path, out_path, c->hardlink));
+            free(entry.path);
+        }
+        if(!hit)
+            atomic_fetch_add(&c->wasted, 1);
+    }
+    free(dir.path);
+
+    atomic_fetch_add(hit ? &c->hits : &c->misses, 1);
+    return hit;
+}
+
+void cache_hash_init(const cache_key *key, hash_state *digest) {
+    hash_init(digest, key->seed);
+}
+
+void cache_store(encode_cache *c, const cache_key *key, uint64_t digest, const char *out_path) {
+    filepath dir = probe_dir(c, key->probe);
+    filepath entry = (dir.path != NULL) ? entry_path(dir, digest) : (filepath) { NULL, 0 };
+    if(entry.path == NULL || f_access(entry.path, test_existence) == 0) { // Someone else got there first
+        free(dir.path);
+        free(entry.path);
+        return;
+    }
+
+    // Build the entry under a temporary name so other jobs and processes never see it half written
+    make_dir(dir.path);
+    size_t tmp_len = entry.path_len + 22;
+    char *tmp = malloc(tmp_len);
+    if(tmp != NULL) {
+        uint64_t unique = hash_buffer(out_path, strlen(out_path), (uint64_t)atomic_fetch_add(&c->serial, 1));
+        snprintf(tmp, tmp_len, "%s.%016llx.tmp", entry.path, (unsigned long long)unique);
+        if(place_file(out_path, tmp, c->hardlink) && rename(tmp, entry.path) == 0)
+            atomic_fetch_add(&c->stored, 1);
+        else
+            remove(tmp);
+    }
+
+    free(tmp);
+    free(dir.path);
+    free(entry.path);
+}
+
+void cache_report(encode_cache *c) {
+    printf("Encode cache: %ld hits, %ld misses, %ld stored\n", atomic_load_acquire(&c->hits),
+           atomic_load_acquire(&c->misses), atomic_load_acquire(&c->stored));
+    if(atomic_load_acquire(&c->wasted) > 0)
+        printf("Encode cache: %ld files hashed ahead of encoding for nothing\n", atomic_load_acquire(&c->wasted));
+}
+
+void cache_close(encode_cache *c) {
+    free(c->dir.path);
+    free(c);
+}
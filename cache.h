@@ -0,0 +1,57 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem_access.h"
+#include "hash.h"
+
+/*
+ * Content-addressed store of finished MP3s, so audio that was encoded before under another name or path is
+ * copied instead of encoded again. Entries are keyed by an XXH64 of the PCM data, seeded with a hash of the
+ * encoder settings, the sample format and the LAME version, and are kept as <dir>/<probe>/<digest>.mp3.
+ * The probe hashes the data length and the first CACHE_PROBE_BYTES of PCM, so it is cheap to compute before
+ * encoding. The whole file is only hashed up front if an entry with the same probe exists. On a miss the
+ * digest is computed from the blocks the encoder reads anyway, and the MP3 is stored once it is written.
+ * All functions are thread-safe, and several processes may share a cache dir.
+ */
+#define CACHE_PROBE_BYTES (1024 * 1024)
+
+typedef struct encode_cache_t encode_cache;
+
+typedef struct cache_key_t {
+    uint64_t seed;                   // Hash of the settings and format, the seed of the PCM hashes
+    uint64_t probe;
+} cache_key;
+
+//! The PCM data of a job
+typedef struct cache_source_t {
+    const char *path;
+    const unsigned char *pcm;        // The data if the file is mapped, or NULL to read it from path
+    long long offset;                // Position of the data in the file
+    long long len;                   // Length of the data, which may run past the end of a truncated file
+} cache_source;
+
+//! Use dir as the cache, creating it if need be. With hardlink, cached MP3s are hard linked to their outputs
+//! where possible instead of being cloned or copied. Returns NULL on failure.
+encode_cache *cache_open(filepath dir, bool hardlink);
+
+//! Compute the key of a job encoded with the given settings, which must identify everything besides the WAV
+//! format that changes the MP3. If the cache has an MP3 for its PCM data, put a copy at out_path and return
+//! true. Otherwise return false, after which the job is encoded with the digest from cache_hash_init().
+bool cache_fetch(encode_cache *c, const cache_source *src, const wav_header *fmt, const char *settings,
+                 cache_key *key, const char *out_path);
+
+//! Start the digest of a job's PCM data, to be fed the data as it is encoded
+void cache_hash_init(const cache_key *key, hash_state *digest);
+
+//! Add the MP3 at out_path, encoded from PCM data with the given digest, to the cache
+void cache_store(encode_cache *c, const cache_key *key, uint64_t digest, const char *out_path);
+
+//! Print hit and miss counts
+void cache_report(encode_cache *c);
+
+void cache_close(encode_cache *c);
+
+#endif /* CACHE_H_ */
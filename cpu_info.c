@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "cpu_info.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define CGROUP_PATH_LEN (4096)
+#define MAX_AFFINITY_CPUS (1 << 16) // Give up growing the mask past this many CPUs
+#define MAX_NUMA_NODES    (1024)
+#define MPOL_PREFERRED    (1)       // From <linux/mempolicy.h>, which not every libc ships
+
+//! The affinity mask of this process, to be freed with CPU_FREE(), or NULL if it can't be read. The mask is
+//! grown for hosts with more than CPU_SETSIZE CPUs.
+static cpu_set_t *affinity_set(int *n_cpus, size_t *size) {
+    for(int n = 1024; n <= MAX_AFFINITY_CPUS; n *= 2) {
+        cpu_set_t *set = CPU_ALLOC(n);
+        if(set == NULL)
+            return NULL;
+
+        *n_cpus = n;
+        *size = CPU_ALLOC_SIZE(n);
+        CPU_ZERO_S(*size, set);
+        if(sched_getaffinity(0, *size, set) == 0)
+            return set;
+        CPU_FREE(set);
+        if(errno != EINVAL) // EINVAL means the mask was too small for the kernel's
+            return NULL;
+    }
+    return NULL;
+}
+
+//! CPUs in the affinity mask, or -1 if it can't be read
+static int affinity_cpus(void) {
+    int n_cpus;
+    size_t size;
+    cpu_set_t *set = affinity_set(&n_cpus, &size);
+    if(set == NULL)
+        return -1;
+
+    int count = CPU_COUNT_S(size, set);
+    CPU_FREE(set);
+    return count;
+}
+
+//! The CFS quota set in one cgroup dir, in CPUs, or 0 if there is none
+static double read_quota(const char *dir, bool v2) {
+    char path[2 * CGROUP_PATH_LEN + 32];
+    long long quota = -1, period = 0;
+    FILE *file;
+
+    if(v2) { // "max 100000" or "<quota> <period>"
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        if((file = fopen(path, "r")) == NULL)
+            return 0;
+        if(fscanf(file, "%lld %lld", &quota, &period) != 2)
+            quota = -1;
+        fclose(file);
+    }
+    else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        if((file = fopen(path, "r")) == NULL)
+            return 0;
+        if(fscanf(file, "%lld", &quota) != 1)
+            quota = -1;
+        fclose(file);
+
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        if((file = fopen(path, "r")) == NULL)
+            return 0;
+        if(fscanf(file, "%lld", &period) != 1)
+            period = 0;
+        fclose(file);
+    }
+
+    return (quota > 0 && period > 0) ? (double)quota / (double)period : 0;
+}
+
+//! Whether a comma separated list of cgroup v1 controllers or mount options names the cpu controller
+static bool has_cpu_controller(const char *list) {
+    size_t len;
+    for(; *list != '\0'; list += len + (list[len] == ',')) {
+        len = strcspn(list, ",");
+        if(len == 3 && strncmp(list, "cpu", 3) == 0)
+            return true;
+    }
+    return false;
+}
+
+//! This process's path in the cgroup v2 hierarchy or, with v1, in the hierarchy with the cpu controller
+static bool cgroup_path(bool v2, char *path, size_t len) {
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    char line[CGROUP_PATH_LEN + 128];
+    bool found = false;
+
+    if(file == NULL)
+        return false;
+    while(!found && fgets(line, sizeof(line), file) != NULL) { // "<id>:<controllers>:<path>"
+        char *controllers = strchr(line, ':');
+        char *rest = (controllers != NULL) ? strchr(controllers + 1, ':') : NULL;
+        if(rest == NULL)
+            continue;
+        *controllers++ = '\0';
+        *rest++ = '\0';
+        rest[strcspn(rest, "\n")] = '\0';
+
+        found = v2 ? (strcmp(line, "0") == 0 && *controllers == '\0') : has_cpu_controller(controllers);
+        if(found)
+            snprintf(path, len, "%s", rest);
+    }
+    fclose(file);
+    return found;
+}
+
+/*! Find where the cgroup hierarchy is mounted. root receives the part of the hierarchy the mount shows,
+ *  which is not "/" inside containers with their own cgroup namespace or bind mounted cgroups.
+ */
+static bool cgroup_mount(bool v2, char *root, char *mount_point, size_t len) {
+    FILE *file = fopen("/proc/self/mountinfo", "r");
+    char line[2 * CGROUP_PATH_LEN + 256];
+    bool found = false;
+
+    if(file == NULL)
+        return false;
+    while(!found && fgets(line, sizeof(line), file) != NULL) {
+        // "<id> <parent> <dev> <root> <mount point> <options> [optional fields] - <type> <source> <super options>"
+        char fields[2][CGROUP_PATH_LEN], type[32], options[512];
+        char *sep = strstr(line, " - ");
+        if(sep == NULL || sscanf(line, "%*s %*s %*s %4095s %4095s", fields[0], fields[1]) != 2 ||
+           sscanf(sep + 3, "%31s %*s %511s", type, options) != 2)
+            continue;
+
+        found = v2 ? (strcmp(type, "cgroup2") == 0) : (strcmp(type, "cgroup") == 0 && has_cpu_controller(options));
+        if(found) {
+            snprintf(root, len, "%s", fields[0]);
+            snprintf(mount_point, len, "%s", fields[1]);
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+//! The lowest CFS quota of this process's cgroup and its ancestors, in CPUs, or 0 if there is none
+static double cgroup_quota(bool v2) {
+    char path[CGROUP_PATH_LEN], root[CGROUP_PATH_LEN], mount_point[CGROUP_PATH_LEN];
+    char dir[2 * CGROUP_PATH_LEN];
+
+    if(!cgroup_path(v2, path, sizeof(path)) || !cgroup_mount(v2, root, mount_point, sizeof(root)))
+        return 0;
+
+    // Make the cgroup path relative to what the mount shows
+    const char *rel = path;
+    size_t root_len = strlen(root);
+    if(strcmp(root, "/") != 0 && strncmp(path, root, root_len) == 0 &&
+       (path[root_len] == '/' || path[root_len] == '\0'))
+        rel = &path[root_len];
+
+    snprintf(dir, sizeof(dir), "%s%s", mount_point, (strcmp(rel, "/") == 0) ? "" : rel);
+    size_t mount_len = strlen(mount_point);
+    double lowest = 0;
+
+    while(true) { // Limits of the ancestors apply too
+        double quota = read_quota(dir, v2);
+        if(quota > 0 && (lowest == 0 || quota < lowest))
+            lowest = quota;
+
+        char *last = strrchr(dir, '/');
+        if(last == NULL || (size_t)(last - dir) < mount_len)
+            break;
+        *last = '\0';
+    }
+    return lowest;
+}
+
+int available_cpus(const char **source) {
+    int cpus = getNumCPUs();
+    *source = "online CPUs";
+
+    int affinity = affinity_cpus();
+    if(affinity > 0 && affinity < cpus) {
+        cpus = affinity;
+        *source = "CPU affinity mask";
+    }
+
+    bool v2 = true;
+    double quota = cgroup_quota(v2);
+    if(quota == 0)
+        quota = cgroup_quota(v2 = false);
+
+    int quota_cpus = (int)quota;
+    if(quota > quota_cpus)
+        quota_cpus++;
+    if(quota_cpus > 0 && quota_cpus < cpus) {
+        cpus = quota_cpus;
+        *source = v2 ? "cgroup v2 CPU quota" : "cgroup v1 CPU quota";
+    }
+
+    return MAX(1, cpus);
+}
+
+/*****************************************************************************************
+* Worker placement
+****************************************************************************************/
+typedef struct cpu_slot_t {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int thread;                      // Rank among the hardware threads of its core, 0 for the first
+    int node_rank;                   // Rank among the CPUs of its node with the same thread rank
+} cpu_slot;
+
+struct cpu_placement_t {
+    cpu_slot *slots;                 // In the order workers are placed on them
+    int n_slots;
+    int n_cores;
+    int n_nodes;
+};
+
+//! Read an integer from a sysfs file of a CPU, or return fallback
+static int read_cpu_int(int cpu, const char *file, int fallback) {
+    char path[128];
+    int value = fallback;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+
+    FILE *f = fopen(path, "r");
+    if(f != NULL) {
+        if(fscanf(f, "%d", &value) != 1)
+            value = fallback;
+        fclose(f);
+    }
+    return value;
+}
+
+//! NUMA node of a CPU, from the nodeN link in its sysfs dir, or 0 on machines without NUMA support
+static int cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    int node = 0;
+    if(dir == NULL)
+        return 0;
+    while((entry = readdir(dir)) != NULL) {
+        if(strncmp(entry->d_name, "node", 4) == 0 && sscanf(&entry->d_name[4], "%d", &node) == 1)
+            break;
+    }
+    closedir(dir);
+    return MIN(MAX(node, 0), MAX_NUMA_NODES - 1);
+}
+
+//! Physical cores first, spread round robin across nodes, then the second hardware threads and so on
+static int slot_order(const void *a, const void *b) {
+    const cpu_slot *x = a, *y = b;
+    if(x->thread != y->thread)
+        return x->thread - y->thread;
+    if(x->node_rank != y->node_rank)
+        return x->node_rank - y->node_rank;
+    if(x->node != y->node)
+        return x->node - y->node;
+    return x->cpu - y->cpu;
+}
+
+cpu_placement *placement_create(bool use_smt) {
+    int n_cpus;
+    size_t size;
+    cpu_set_t *set = affinity_set(&n_cpus, &size);
+    cpu_placement *p = calloc(1, sizeof(cpu_placement));
+    cpu_slot *slots = (set != NULL) ? calloc(CPU_COUNT_S(size, set), sizeof(cpu_slot)) : NULL;
+
+    if(p == NULL || slots == NULL) {
+        free(p);
+        free(slots);
+        if(set != NULL)
+            CPU_FREE(set);
+        return NULL;
+    }
+
+    int count = 0;
+    for(int cpu = 0; cpu < n_cpus; cpu++) {
+        if(!CPU_ISSET_S(cpu, size, set))
+            continue;
+        cpu_slot *s = &slots[count++];
+        s->cpu = cpu;
+        s->node = cpu_node(cpu);
+        s->package = read_cpu_int(cpu, "topology/physical_package_id", 0);
+        s->core = read_cpu_int(cpu, "topology/core_id", cpu); // Without topology, every CPU is its own core
+    }
+    CPU_FREE(set);
+
+    // Slots are in CPU order here, so earlier siblings and node mates have already been seen
+    bool seen_node[MAX_NUMA_NODES] = { false };
+    for(int i = 0; i < count; i++) {
+        for(int j = 0; j < i; j++) {
+            if(slots[j].package == slots[i].package && slots[j].core == slots[i].core)
+                slots[i].thread++;
+        }
+        for(int j = 0; j < i; j++) {
+            if(slots[j].node == slots[i].node && slots[j].thread == slots[i].thread)
+                slots[i].node_rank++;
+        }
+        if(slots[i].thread == 0)
+            p->n_cores++;
+        if(!seen_node[slots[i].node]) {
+            seen_node[slots[i].node] = true;
+            p->n_nodes++;
+        }
+    }
+
+    qsort(slots, count, sizeof(cpu_slot), slot_order);
+    p->slots = slots;
+    p->n_slots = use_smt ? count : p->n_cores;
+    return p;
+}
+
+int placement_slots(const cpu_placement *p) {
+    return p->n_slots;
+}
+
+bool placement_apply(const cpu_placement *p, int worker_id) {
+    const cpu_slot *s = &p->slots[worker_id % p->n_slots];
+    cpu_set_t *set = CPU_ALLOC(s->cpu + 1);
+    if(set == NULL)
+        return false;
+
+    size_t size = CPU_ALLOC_SIZE(s->cpu + 1);
+    CPU_ZERO_S(size, set);
+    CPU_SET_S(s->cpu, size, set);
+    bool ok = (pthread_setaffinity_np(pthread_self(), size, set) == 0);
+    CPU_FREE(set);
+
+    // Prefer the local node for everything the worker allocates from now on, its arena and encoders included
+    unsigned long nodes[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    nodes[s->node / (8 * sizeof(unsigned long))] |= 1UL << (s->node % (8 * sizeof(unsigned long)));
+    if(p->n_nodes > 1)
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, (unsigned long)MAX_NUMA_NODES);
+    return ok;
+}
+
+void placement_report(const cpu_placement *p, int n_workers) {
+    int threads = MIN(n_workers, p->n_slots);
+    printf("Pinning %d workers to %d %s on %d NUMA node%s\n", n_workers, threads,
+           (p->n_slots > p->n_cores && threads > p->n_cores) ? "hardware threads" : "cores", p->n_nodes,
+           (p->n_nodes == 1) ? "" : "s");
+    if(n_workers > p->n_slots)
+        printf("There are more workers than %s, so some of them share one\n",
+               (p->n_slots > p->n_cores) ? "hardware threads" : "cores");
+}
+
+void placement_destroy(cpu_placement *p) {
+    free(p->slots);
+    free(p);
+}
+
+#elif defined(_WIN32)
+
+int available_cpus(const char **source) {
+    DWORD_PTR process_mask, system_mask;
+    int cpus = getNumCPUs();
+    *source = "online CPUs";
+
+    if(GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        int count = 0;
+        for(; process_mask != 0; process_mask &= process_mask - 1)
+            count++;
+        if(count > 0 && count < cpus) {
+            cpus = count;
+            *source = "CPU affinity mask";
+        }
+    }
+    return MAX(1, cpus);
+}
+
+cpu_placement *placement_create(bool use_smt) {
+    (void)use_smt;
+    return NULL;
+}
+
+int placement_slots(const cpu_placement *p) {
+    return 0;
+}
+
+bool placement_apply(const cpu_placement *p, int worker_id) {
+    return false;
+}
+
+void placement_report(const cpu_placement *p, int n_workers) {
+}
+
+void placement_destroy(cpu_placement *p) {
+}
+
+#else
+
+int available_cpus(const char **source) {
+    *source = "online CPUs";
+    return MAX(1, getNumCPUs());
+}
+
+cpu_placement *placement_create(bool use_smt) {
+    (void)use_smt;
+    return NULL;
+}
+
+int placement_slots(const cpu_placement *p) {
+    return 0;
+}
+
+bool placement_apply(const cpu_placement *p, int worker_id) {
+    return false;
+}
+
+void placement_report(const cpu_placement *p, int n_workers) {
+}
+
+void placement_destroy(cpu_placement *p) {
+}
+
+#endif
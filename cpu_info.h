@@ -0,0 +1,40 @@
+#ifndef CPU_INFO_H_
+#define CPU_INFO_H_
+
+#include <stdbool.h>
+
+/*
+ * Number of CPUs this process can actually run on. The count of online CPUs is often far too high: in a
+ * container it is the host's, while the cgroup CPU quota or the affinity mask (taskset, cpusets) allows only
+ * a few. On Linux the result is the lowest of the online CPUs, the affinity mask and the CFS quota of the
+ * process's cgroup and its ancestors, under cgroup v2 or v1. A fractional quota is rounded up.
+ */
+
+//! Number of CPUs available to this process, at least 1. *source receives a description of the limit that
+//! decided it, for logging.
+int available_cpus(const char **source);
+
+/*
+ * Placement of pool workers on the CPU topology read from /sys/devices/system/cpu (Linux only). Workers go
+ * to one hardware thread of every physical core first, spread round robin across NUMA nodes, and to the
+ * remaining hardware threads of each core only if SMT is asked for. Worker n always gets the same CPU, so
+ * runs are reproducible. Only CPUs in the affinity mask are used.
+ */
+typedef struct cpu_placement_t cpu_placement;
+
+//! Read the topology. Returns NULL if it isn't available on this platform.
+cpu_placement *placement_create(bool use_smt);
+
+//! Number of CPUs workers are placed on: physical cores, or hardware threads with SMT
+int placement_slots(const cpu_placement *p);
+
+//! Pin the calling thread to the CPU of worker_id and make it allocate memory on that CPU's node. Call it
+//! from a worker before it allocates anything. Returns false if the thread couldn't be pinned.
+bool placement_apply(const cpu_placement *p, int worker_id);
+
+//! Print where n_workers workers go
+void placement_report(const cpu_placement *p, int n_workers);
+
+void placement_destroy(cpu_placement *p);
+
+#endif /* CPU_INFO_H_ */
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <lame/lame.h>
+
+#include "encoder.h"
+#include "pcm_convert.h"
+#include "trace.h"
+
+static void configure_encoder(lame_t lame, const wav_header *fmt, int quality) {
+    lame_set_VBR(lame, ENCODER_VBR_MODE);
+    lame_set_num_channels(lame, fmt->n_channels);
+    lame_set_in_samplerate(lame, fmt->sample_rate);
+    lame_set_out_samplerate(lame, fmt->sample_rate);
+    if(fmt->n_channels == 1)
+        lame_set_mode(lame, 3); // Set encoder to mono
+    lame_set_quality(lame, quality);
+}
+
+lame_t init_encoder(const wav_header *fmt, int quality, int flags) {
+    lame_t lame = lame_init();
+    if(lame == NULL)
+        return NULL;
+
+    configure_encoder(lame, fmt, quality);
+    if(flags & ENCODER_SEGMENT)
+        lame_set_disable_reservoir(lame, 1);
+    if(flags & ENCODER_NO_TAG)
+        lame_set_bWriteVbrTag(lame, 0);
+    if(lame_init_params(lame) < 0) {
+        lame_close(lame);
+        return NULL;
+    }
+    return lame;
+}
+
+int encode_frames(lame_t lame, const wav_header *fmt, const unsigned char *pcm, int frames, float gain,
+                  int32_t *scratch, unsigned char *mp3, int mp3_size) {
+    int32_t *left = scratch, *right = &scratch[PCM_SIZE];
+    bool stereo = (fmt->n_channels == 2);
+
+    if(gain == 1.0f) { // Formats LAME takes without widening
+        if(fmt->format_type == WAVE_FORMAT_IEEE_FLOAT) { // LAME scales floats in [-1, 1] itself
+            if(!stereo)
+                return lame_encode_buffer_ieee_float(lame, (const float *)pcm, (const float *)pcm, frames, mp3, mp3_size);
+            return lame_encode_buffer_interleaved_ieee_float(lame, (const float *)pcm, frames, mp3, mp3_size);
+        }
+        if(fmt->bits_per_sample == 16) {
+            if(!stereo)
+                return lame_encode_buffer(lame, (const short int *)pcm, NULL, frames, mp3, mp3_size);
+            int16_t *left16 = (int16_t *)scratch, *right16 = &left16[PCM_SIZE];
+            pcm_split_s16(pcm, left16, right16, frames);
+            return lame_encode_buffer(lame, left16, right16, frames, mp3, mp3_size);
+        }
+    }
+
+    if(fmt->format_type == WAVE_FORMAT_IEEE_FLOAT)
+        pcm_convert_f32(pcm, left, right, frames, fmt->n_channels, gain); // Applies the gain on the way
+    else {
+        switch(fmt->bits_per_sample) {
+        case 16:
+            pcm_unpack_s16(pcm, left, right, frames, fmt->n_channels);
+            break;
+        case 24:
+            pcm_unpack_s24(pcm, left, right, frames, fmt->n_channels);
+            break;
+        case 32:
+            pcm_split_s32(pcm, left, right, frames, fmt->n_channels);
+            break;
+        default:
+            return -1;
+        }
+
+        if(gain != 1.0f) {
+            pcm_gain_s32(left, frames, gain);
+            if(stereo)
+                pcm_gain_s32(right, frames, gain);
+        }
+    }
+    return lame_encode_buffer_int(lame, left, stereo ? right : left, frames, mp3, mp3_size);
+}
+
+//! Transcode the input WAV into an MP3 file in the output directory
+bool encode(block_reader *pcm, const wav_header *fmt, block_writer *mp3, lame_t lame, int32_t *scratch,
+            float gain, hash_state *digests, int n_digests) {
+    const unsigned char *block;
+    unsigned char *mp3_buffer;
+    int read, write;
+    bool ok = true;
+    int block_align = fmt->block_align;
+
+    do {
+        stage_begin(STAGE_READ);
+        size_t len = pcm->next(pcm, &block);
+        read = (int)(len / block_align);
+        for(int i = 0; i < n_digests && len > 0; i++)
+            hash_update(&digests[i], block, len);
+        stage_end();
+
+        stage_begin(STAGE_WRITE);
+        mp3_buffer = mp3->reserve(mp3, MP3_BUFFER_BOUND(PCM_SIZE));
+        stage_end();
+        if(mp3_buffer == NULL) {
+            ok = false;
+            break;
+        }
+
+        stage_begin((read == 0) ? STAGE_FLUSH : STAGE_ENCODE);
+        if (read == 0)
+            write = lame_encode_flush(lame, mp3_buffer, MP3_BUFFER_BOUND(PCM_SIZE));
+        else
+            write = encode_frames(lame, fmt, block, read, gain, scratch, mp3_buffer, MP3_BUFFER_BOUND(PCM_SIZE));
+        stage_end();
+
+        stage_begin(STAGE_WRITE);
+        bool committed = (write >= 0 && mp3->commit(mp3, write));
+        stage_end();
+        if(!committed) {
+            ok = false;
+            break;
+        }
+    } while (read != 0);
+
+    if(ok && pcm->failed(pcm)) {
+        puts("Could not read WAV file");
+        ok = false;
+    }
+
+    if(ok) {
+        unsigned char tag[MAX_TAG_FRAME];
+        stage_begin(STAGE_TAG);
+        size_t tag_len = lame_get_lametag_frame(lame, tag, sizeof(tag));
+        if(tag_len > 0 && tag_len <= sizeof(tag))
+            mp3->write_at(mp3, 0, tag, tag_len);
+        stage_end();
+    }
+    else
+        puts("Encoding failed");
+    return ok;
+}
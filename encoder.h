@@ -0,0 +1,47 @@
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <lame/lame.h>
+
+#include "filesystem_access.h"
+#include "block_io.h"
+#include "hash.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define PCM_SIZE      (8192)
+#define MAX_TAG_FRAME (2880) // Largest Layer III frame LAME may use for the VBR tag
+#define ENCODER_VBR_MODE (vbr_default)
+
+//! Worst-case number of MP3 bytes LAME can emit for the given number of samples per channel
+#define MP3_BUFFER_BOUND(samples) ((5 * (samples)) / 4 + 7200)
+
+//! Scratch space encode_frames() needs to convert PCM_SIZE frames, in int32_t
+#define PCM_SCRATCH_SIZE (2 * PCM_SIZE)
+
+#define ENCODER_SEGMENT (1 << 0) // Disable the bit reservoir so frames can be cut apart, see split_encode.h
+#define ENCODER_NO_TAG  (1 << 1) // Don't reserve a frame for the Xing/LAME tag
+
+//! Create a LAME instance with the standard settings for the given input format. flags is a combination of
+//! ENCODER_SEGMENT and ENCODER_NO_TAG. Returns NULL if LAME rejects the settings. Every stream needs an
+//! instance of its own: lame_init_params() runs once per instance, and the gapless API that starts a new
+//! bitstream carries the previous stream's buffered audio into it.
+lame_t init_encoder(const wav_header *fmt, int quality, int flags);
+
+//! Feed up to PCM_SIZE frames of raw PCM in fmt's sample format to LAME, scaled by gain, converting it to
+//! a layout LAME accepts in scratch if need be. Returns the number of MP3 bytes written, or a negative LAME
+//! error code.
+int encode_frames(lame_t lame, const wav_header *fmt, const unsigned char *pcm, int frames, float gain,
+                  int32_t *scratch, unsigned char *mp3, int mp3_size);
+
+//! Transcode the PCM blocks from pcm into mp3 on lame, scaled by gain with the help of PCM_SCRATCH_SIZE samples
+//! of scratch, and write the VBR tag at the start of the output. The stream of lame is finished afterwards and
+//! it must be closed. The PCM bytes are fed to each of the n_digests states in digests as they are read.
+//! Returns false if encoding or writing failed.
+bool encode(block_reader *pcm, const wav_header *fmt, block_writer *mp3, lame_t lame, int32_t *scratch,
+            float gain, hash_state *digests, int n_digests);
+
+#endif /* ENCODER_H_ */
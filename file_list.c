@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "file_list.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define INITIAL_RECORD_LEN (2 * INITIAL_SYS_PATH_LEN + 2)
+
+//! Read one record into *buffer, growing it as needed. Returns its length, -1 at EOF or -2 if out of memory.
+static long read_record(FILE *list, int terminator, char **buffer, size_t *capacity) {
+    size_t len = 0;
+    int c;
+
+    while((c = getc(list)) != EOF && c != terminator) {
+        if(len + 1 == *capacity) {
+            size_t grown = 2 * *capacity;
+            char *tmp = realloc(*buffer, grown);
+            if(tmp == NULL)
+                return -2;
+            *buffer = tmp;
+            *capacity = grown;
+        }
+        (*buffer)[len++] = (char)c;
+    }
+
+    if(c == EOF && len == 0)
+        return -1;
+    (*buffer)[len] = '\0'; // A last record without a terminator still counts
+    return (long)len;
+}
+
+bool read_file_list(FILE *list, bool nul_separated, list_callback cb) {
+    size_t capacity = INITIAL_RECORD_LEN;
+    char *record = malloc(capacity);
+    long len;
+
+    if(record == NULL)
+        return false;
+
+    while((len = read_record(list, nul_separated ? '\0' : '\n', &record, &capacity)) >= 0) {
+        if(!nul_separated && len > 0 && record[len - 1] == '\r')
+            record[--len] = '\0';
+        if(len == 0)
+            continue;
+
+        char *out_path = strchr(record, '\t');
+        if(out_path != NULL)
+            *out_path++ = '\0';
+        if(record[0] != '\0')
+            cb.func(record, (out_path != NULL && *out_path != '\0') ? out_path : NULL, cb.args);
+    }
+
+    bool ok = (len == -1 && !ferror(list));
+    free(record);
+    return ok;
+}
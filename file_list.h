@@ -0,0 +1,22 @@
+#ifndef FILE_LIST_H_
+#define FILE_LIST_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Reader for lists of files to encode, for callers that already know which WAVs need encoding and want to
+ * skip the directory scan. Every record names a WAV, optionally followed by a tab and the MP3 to write it to.
+ * Records end with a newline, or with a NUL for lists that must carry any possible path, as written by
+ * find -print0. Empty records are ignored, as are carriage returns ending newline terminated ones.
+ */
+typedef struct list_callback_t {
+    void (*func)(char *in_path, char *out_path, void *args); // out_path is NULL if the record has none
+    void *args;
+} list_callback;
+
+//! Call cb.func for every record in list as soon as it has been read, until EOF. The paths are only valid
+//! during the call. Returns false if the list could not be read to the end.
+bool read_file_list(FILE *list, bool nul_separated, list_callback cb);
+
+#endif /* FILE_LIST_H_ */
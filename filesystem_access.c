@@ -3,23 +3,25 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include <dirent.h>
+#include "system_shims.h"
 #include "filesystem_access.h"
 
 // Specific incompatibilities between *nix and windows
 #if defined(_WIN32)
     #define SYS_PATH_SEPARATOR '\\'
-    #define lc_strstr(str1, str2) _stricmp((str1), (str2))
+    #define lc_strcmp(str1, str2) _stricmp((str1), (str2))
 #else
     #define SYS_PATH_SEPARATOR '/'
-    #define lc_strstr(str1, str2) (strcasestr((str1), (str2)) == NULL)
+    #define lc_strcmp(str1, str2) strcasecmp((str1), (str2))
 #endif
 
 
 filepath set_path(filepath dest, filepath src) {
     if(dest.path_len < src.path_len || dest.path == NULL) {
-        char *tmp = realloc(dest.path, src.path_len);
+        char *tmp = realloc(dest.path, src.path_len + 1);
         if(tmp != NULL)
             dest.path = tmp;
         else
@@ -77,7 +79,7 @@ char *get_ext(char *filename) {
 int match_extension(char *filename, char *extension) {
     char *file_ext = get_ext(filename);
     if(file_ext != NULL)
-        return (lc_strstr(file_ext, extension) == 0); // case-insensitive comparison
+        return (lc_strcmp(file_ext, extension) == 0); // case-insensitive comparison
     else
         return 0;
 }
@@ -102,19 +104,313 @@ bool traverse_dir(filepath cwd, char *extension, callback cb) {
     return true;
 }
 
-bool parse_wav(wav_header *params, FILE *wav) {
-    int errors = 0;
-    int f_ret = fread(params, 1, sizeof(wav_header), wav);
-    
-    errors += (f_ret < sizeof(wav_header));
-    errors += (memcmp(&params->chunk_id   , "RIFF", 4) != 0);
-    errors += (memcmp(&params->format     , "WAVE", 4) != 0);
-    errors += (memcmp(&params->subchunk_id, "fmt ", 4) != 0);
-
-    if(!errors) {
-        fseek(wav, params->subchunk_len + 28, SEEK_SET);
+/*****************************************************************************************
+* Parallel tree walker
+****************************************************************************************/
+typedef struct tree_walk_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond_var;        // Signalled when a directory is queued or the walk is complete
+
+    filepath *dirs;                  // Directories waiting to be read. A stack, so the walk stays depth-first
+    size_t queued;
+    size_t capacity;
+    int  busy;                       // Walkers currently reading a directory
+    bool failed;
+
+    char *extension;
+    callback cb;
+} tree_walk;
+
+//! Queue a directory for reading. Called with the mutex held. Takes ownership of dir.path.
+static void push_dir(tree_walk *walk, filepath dir) {
+    if(walk->queued == walk->capacity) {
+        size_t capacity = MAX(64, 2 * walk->capacity);
+        filepath *tmp = realloc(walk->dirs, capacity * sizeof(filepath));
+        if(tmp == NULL) {
+            printf("Could not queue directory '%s'\n", dir.path);
+            walk->failed = true;
+            free(dir.path);
+            return;
+        }
+        walk->dirs = tmp;
+        walk->capacity = capacity;
+    }
+    walk->dirs[walk->queued++] = dir;
+    pthread_cond_signal(&walk->cond_var);
+}
+
+bool is_subdir(filepath dir, struct dirent *entry) {
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        return false;
+    if(entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_DIR;
+
+    // Some filesystems don't report types in the directory listing
+    filepath full = get_full_path(dir, (filepath) { entry->d_name, strlen(entry->d_name) });
+    bool is_dir = false;
+    if(full.path != NULL) {
+#if defined(_WIN32)
+        struct _stat64 st;
+        is_dir = (_stat64(full.path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR);
+#else
+        struct stat st;
+        is_dir = (lstat(full.path, &st) == 0 && S_ISDIR(st.st_mode));
+#endif
+    }
+    free(full.path);
+    return is_dir;
+}
+
+static void walk_dir(tree_walk *walk, filepath cwd) {
+    struct dirent *p_dir;
+    DIR *dir = opendir(cwd.path);
+    if(dir == NULL) {
+        printf("Cannot open directory '%s'\n", cwd.path);
+        return;
+    }
+
+    while((p_dir = readdir(dir)) != NULL) {
+        filepath name = { p_dir->d_name, strlen(p_dir->d_name) };
+
+        if(is_subdir(cwd, p_dir)) {
+            filepath sub = normalize_filepath(get_full_path(cwd, name));
+            pthread_mutex_lock(&walk->mutex);
+            if(sub.path != NULL)
+                push_dir(walk, sub);
+            else
+                walk->failed = true;
+            pthread_mutex_unlock(&walk->mutex);
+        }
+        else if(match_extension(p_dir->d_name, walk->extension))
+            walk->cb.func(cwd, name, walk->cb.args);
+    }
+    closedir(dir);
+}
+
+static void *walker_main(void *arg) {
+    tree_walk *walk = arg;
+
+    pthread_mutex_lock(&walk->mutex);
+    while(1) {
+        while(walk->queued == 0 && walk->busy > 0)
+            pthread_cond_wait(&walk->cond_var, &walk->mutex);
+
+        if(walk->queued == 0) // Nothing queued and nobody left to find more
+            break;
+
+        filepath dir = walk->dirs[--walk->queued];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->mutex);
+
+        walk_dir(walk, dir);
+        free(dir.path);
+
+        pthread_mutex_lock(&walk->mutex);
+        walk->busy--;
+    }
+    pthread_cond_broadcast(&walk->cond_var);
+    pthread_mutex_unlock(&walk->mutex);
+
+    return NULL;
+}
+
+bool walk_tree(filepath root, char *extension, int n_walkers, callback cb) {
+    tree_walk walk = { .dirs = NULL, .queued = 0, .capacity = 0, .busy = 0, .failed = false,
+                       .extension = extension, .cb = cb };
+    pthread_t *walkers = calloc(n_walkers, sizeof(pthread_t));
+    filepath start = get_full_path(root, (filepath) { "", 0 }); // A copy the walkers can free
+    if(walkers == NULL || start.path == NULL) {
+        free(start.path);
+        free(walkers);
         return false;
     }
-    else 
+
+    pthread_mutex_init(&walk.mutex, NULL);
+    pthread_cond_init(&walk.cond_var, NULL);
+    push_dir(&walk, start);
+
+    for(int i = 0; i < n_walkers; i++)
+        pthread_create(&walkers[i], NULL, walker_main, &walk);
+    for(int i = 0; i < n_walkers; i++)
+        pthread_join(walkers[i], NULL);
+
+    pthread_cond_destroy(&walk.cond_var);
+    pthread_mutex_destroy(&walk.mutex);
+    free(walk.dirs);
+    free(walkers);
+    return !walk.failed;
+}
+
+bool make_dirs(filepath path) {
+    char *p = path.path;
+
+    for(size_t i = 1; i <= path.path_len; i++) {
+        if(i < path.path_len && p[i] != '/' && p[i] != SYS_PATH_SEPARATOR)
+            continue;
+
+        char c = p[i];
+        p[i] = '\0'; // Create every prefix ending at a separator, and finally the whole path
+        bool ok = (f_access(p, test_existence) == 0 || make_dir(p) == 0 || errno == EEXIST);
+        p[i] = c;
+        if(!ok)
+            return false;
+    }
+    return true;
+}
+
+size_t dir_part_len(const char *path) {
+    size_t len = 0;
+    for(size_t i = 0; path[i] != '\0'; i++) {
+        if(path[i] == '/' || path[i] == SYS_PATH_SEPARATOR)
+            len = i + 1;
+    }
+    return len;
+}
+
+/*****************************************************************************************
+* RIFF chunk walker
+****************************************************************************************/
+#define WAV_PREFETCH (64 * 1024) // Covers the chunks in front of the PCM data of nearly every file in one read
+
+//! Window onto the start of a WAV file, either all of it in memory or refilled from file as needed
+typedef struct riff_source_t {
+    const unsigned char *window;
+    size_t window_len;
+    long long window_start;          // file offset of window[0]
+    FILE *file;                      // NULL if the whole file is in memory
+    unsigned char *buffer;
+} riff_source;
+
+// SubFormat GUIDs of extensible files are KSDATAFORMAT_SUBTYPE_xxx, the format code followed by these bytes
+static const unsigned char ksdataformat_tail[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+                                                     0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+
+static uint16_t get_le16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//! Point at len bytes at offset, refilling the window from file if they aren't in it. NULL past the end.
+static const unsigned char *riff_peek(riff_source *src, long long offset, size_t len) {
+    if(offset < src->window_start || offset + (long long)len > src->window_start + (long long)src->window_len) {
+        if(src->file == NULL || len > WAV_PREFETCH || fseek(src->file, (long)offset, SEEK_SET) != 0)
+            return NULL;
+        src->window = src->buffer;
+        src->window_start = offset;
+        src->window_len = fread(src->buffer, 1, WAV_PREFETCH, src->file);
+        if((long long)len > (long long)src->window_len)
+            return NULL;
+    }
+    return &src->window[offset - src->window_start];
+}
+
+static bool parse_fmt(wav_header *params, const unsigned char *fmt, uint32_t len) {
+    if(len < 16)
+        return true;
+
+    params->format_type = get_le16(&fmt[0]);
+    params->n_channels = get_le16(&fmt[2]);
+    params->sample_rate = get_le32(&fmt[4]);
+    params->byte_rate = get_le32(&fmt[8]);
+    params->block_align = get_le16(&fmt[12]);
+    params->bits_per_sample = get_le16(&fmt[14]);
+    params->valid_bits = params->bits_per_sample;
+
+    if(params->format_type == WAVE_FORMAT_EXTENSIBLE) {
+        if(len < 40 || get_le16(&fmt[16]) < 22 || memcmp(&fmt[26], ksdataformat_tail, sizeof(ksdataformat_tail)) != 0)
+            return true;
+        params->valid_bits = get_le16(&fmt[18]);
+        params->channel_mask = get_le32(&fmt[20]);
+        params->format_type = get_le16(&fmt[24]);
+    }
+    return false;
+}
+
+//! Formats the encoder can take
+static int format_errors(wav_header *params) {
+    int errors = 0;
+
+    if(params->format_type == WAVE_FORMAT_IEEE_FLOAT)
+        errors += (params->bits_per_sample != 32);
+    else if(params->format_type == WAVE_FORMAT_PCM)
+        errors += (params->bits_per_sample != 16 && params->bits_per_sample != 24 && params->bits_per_sample != 32);
+    else
+        errors++;
+    errors += (params->n_channels < 1 || params->n_channels > 2);
+    errors += (params->block_align != params->n_channels * params->bits_per_sample / 8);
+    errors += (params->sample_rate == 0);
+    return errors;
+}
+
+/*! Find "fmt " and "data" in one pass over the chunk list, remembering the other chunks on the way. Chunks
+ *  after the PCM data are not looked at, so a huge data chunk never has to be skipped over.
+ */
+static bool walk_chunks(wav_header *params, riff_source *src) {
+    const unsigned char *p = riff_peek(src, 0, 12);
+    bool have_fmt = false;
+    long long offset = 12;
+
+    memset(params, 0, sizeof(wav_header));
+    if(p == NULL || memcmp(&p[0], "RIFF", 4) != 0 || memcmp(&p[8], "WAVE", 4) != 0)
+        return true;
+    params->chunk_size = get_le32(&p[4]);
+
+    while((p = riff_peek(src, offset, 8)) != NULL) {
+        uint32_t len = get_le32(&p[4]);
+        long long body = offset + 8;
+
+        if(memcmp(p, "fmt ", 4) == 0) {
+            const unsigned char *fmt = riff_peek(src, body, MIN(len, 40));
+            if(fmt == NULL || parse_fmt(params, fmt, len))
+                return true;
+            have_fmt = true;
+            if(params->data_offset != 0) // Out of order, but seen in the wild
+                return (format_errors(params) != 0);
+        }
+        else if(memcmp(p, "data", 4) == 0) {
+            params->data_offset = body;
+            params->data_len = len;
+            if(have_fmt)
+                return (format_errors(params) != 0);
+        }
+        else if(params->n_meta < WAV_MAX_META_CHUNKS) {
+            wav_chunk *chunk = &params->meta[params->n_meta++];
+            memcpy(chunk->id, p, 4);
+            chunk->len = len;
+            chunk->offset = body;
+        }
+
+        offset = body + len + (len & 1); // Chunks are padded to an even length
+    }
+
+    return true; // Ran out of file before finding both
+}
+
+bool parse_wav(wav_header *params, FILE *wav) {
+    riff_source src = { .file = wav, .window_start = 0, .window_len = 0 };
+
+    if((src.buffer = malloc(WAV_PREFETCH)) == NULL)
+        return true;
+    src.window = src.buffer;
+
+    bool errors = walk_chunks(params, &src);
+    if(!errors)
+        errors = (fseek(wav, (long)params->data_offset, SEEK_SET) != 0);
+
+    free(src.buffer);
+    return errors;
+}
+
+bool parse_wav_buffer(wav_header *params, const unsigned char *data, size_t len) {
+    riff_source src = { .window = data, .window_len = len, .window_start = 0, .file = NULL, .buffer = NULL };
+
+    if(walk_chunks(params, &src))
         return true;
-}
\ No newline at end of file
+
+    if(params->data_offset + (long long)params->data_len > (long long)len)
+        params->data_len = (uint32_t)(len - params->data_offset);
+    return false;
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /*
  * Thin wrapper around strings representing filepaths, with a defined length.
@@ -14,23 +15,46 @@ typedef struct filepath_t {
 
 typedef void(*file_found_cb)(filepath dir, filepath file, void *args);
 
+struct dirent;
+
 typedef struct callback_t {
     file_found_cb func;
     void *args;
 } callback;
 
+#define WAVE_FORMAT_PCM        (0x0001)
+#define WAVE_FORMAT_IEEE_FLOAT (0x0003)
+#define WAVE_FORMAT_EXTENSIBLE (0xFFFE)
+
+#define WAV_MAX_META_CHUNKS (8) // Chunks other than "fmt " and "data" remembered per file
+
+//! A RIFF chunk that isn't needed for encoding but may be of interest later, e.g. LIST, bext or fact
+typedef struct wav_chunk_t {
+    char     id[4];
+    uint32_t len;                    // length of the chunk body
+    long long offset;                // file offset of the chunk body
+} wav_chunk;
+
+/*
+ * Everything parse_wav() learns about a file. For WAVE_FORMAT_EXTENSIBLE files format_type is taken from
+ * the SubFormat GUID, so the rest of the program only has to deal with the basic format codes.
+ */
 typedef struct wav_header_t {
-    uint8_t  chunk_id[4];            // "RIFF"
     uint32_t chunk_size;             // filesize - 8 bytes
-    uint8_t  format[4];              // "WAVE"
-	uint8_t  subchunk_id[4];         // "fmt "
-	uint32_t subchunk_len;           // length of the format data
-	uint16_t format_type;            // format type. 1 - PCM, 3 - IEEE float, 6 - 8bit A law, 7 - 8bit mu law
-	uint16_t n_channels;             // no.of channels
-	uint32_t sample_rate;            // sampling rate (blocks per second)
-	uint32_t byte_rate;              // sample_rate * n_channels * bits_per_sample/8
-	uint16_t block_align;            // n_channels * bits_per_sample/8
-	uint16_t bits_per_sample;        // bits per sample, 8- 8bits, 16- 16 bits etc
+    uint16_t format_type;            // format type. 1 - PCM, 3 - IEEE float, 6 - 8bit A law, 7 - 8bit mu law
+    uint16_t n_channels;             // no.of channels
+    uint32_t sample_rate;            // sampling rate (blocks per second)
+    uint32_t byte_rate;              // sample_rate * n_channels * bits_per_sample/8
+    uint16_t block_align;            // n_channels * bits_per_sample/8
+    uint16_t bits_per_sample;        // bits per sample, 8- 8bits, 16- 16 bits etc
+    uint16_t valid_bits;             // bits per sample that carry signal, less than the container for some extensible files
+    uint32_t channel_mask;           // speaker positions, extensible files only
+
+    long long data_offset;           // file offset of the PCM data
+    uint32_t  data_len;              // length of the PCM data, which may run past the end of a truncated file
+
+    int       n_meta;
+    wav_chunk meta[WAV_MAX_META_CHUNKS];
 } wav_header;
 
 //! Realloc dest and set it to the value of src
@@ -50,8 +74,27 @@ int match_extension(char *file, char *extension);
 //! Iterate over a directory, calling cb.func with cb.args when a file is found with the specified extension
 bool traverse_dir(filepath cwd, char *extension, callback cb);
 
-//! Parse the WAV format header and point fseek at the PCM-encoded data. Will return false
-//! if no errors are found and true otherwise.
+//! Whether a directory entry read from dir is a subdirectory, i.e. neither "." nor ".." nor a symbolic link
+bool is_subdir(filepath dir, struct dirent *entry);
+
+//! Walk root and every directory below it with n_walkers threads, calling cb.func with cb.args for each file
+//! with the specified extension as soon as it is found. dir is passed with a trailing separator and starts
+//! with root. cb.func is called from several threads at once. Symbolic links to directories are not
+//! followed. Returns once the whole tree has been walked, false if part of it could not be queued.
+bool walk_tree(filepath root, char *extension, int n_walkers, callback cb);
+
+//! Create a directory and any missing parents. Returns false if one can't be created.
+bool make_dirs(filepath path);
+
+//! Length of the directory part of path, up to and including its last separator, or 0 if it has none
+size_t dir_part_len(const char *path);
+
+//! Walk the RIFF chunks up to the PCM data and point fseek at it. Will return false if no errors are found
+//! and the format can be encoded, and true otherwise.
 bool parse_wav(wav_header *params, FILE *wav);
 
+//! Walk the RIFF chunks of a file held in memory, e.g. mapped. data_len is clamped to the buffer. Will
+//! return false if no errors are found and the format can be encoded, and true otherwise.
+bool parse_wav_buffer(wav_header *params, const unsigned char *data, size_t len);
+
 #endif /* FILESYSTEM_ACCESS_H_ */
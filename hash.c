@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME64_1 (0x9E3779B185EBCA87ULL)
+#define PRIME64_2 (0xC2B2AE3D27D4EB4FULL)
+#define PRIME64_3 (0x165667B19E3779F9ULL)
+#define PRIME64_4 (0x85EBCA77C2B2AE63ULL)
+#define PRIME64_5 (0x27D4EB2F165667C5ULL)
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) // Little endian regardless of the host
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+//! Consume whole 32-byte stripes, returning the number of bytes used
+static size_t consume_stripes(hash_state *state, const unsigned char *p, size_t len) {
+    uint64_t v1 = state->acc[0], v2 = state->acc[1], v3 = state->acc[2], v4 = state->acc[3];
+    size_t pos = 0;
+
+    for(; pos + 32 <= len; pos += 32) {
+        v1 = round64(v1, read64(&p[pos]));
+        v2 = round64(v2, read64(&p[pos + 8]));
+        v3 = round64(v3, read64(&p[pos + 16]));
+        v4 = round64(v4, read64(&p[pos + 24]));
+    }
+
+    state->acc[0] = v1, state->acc[1] = v2, state->acc[2] = v3, state->acc[3] = v4;
+    return pos;
+}
+
+void hash_init(hash_state *state, uint64_t seed) {
+    memset(state, 0, sizeof(hash_state));
+    state->acc[0] = seed + PRIME64_1 + PRIME64_2;
+    state->acc[1] = seed + PRIME64_2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - PRIME64_1;
+}
+
+void hash_update(hash_state *state, const void *data, size_t len) {
+    const unsigned char *p = data;
+    state->total_len += len;
+
+    if(state->buffered + len < 32) {
+        memcpy(&state->buffer[state->buffered], p, len);
+        state->buffered += len;
+        return;
+    }
+
+    if(state->buffered > 0) { // Complete the stripe left over from last time
+        size_t fill = 32 - state->buffered;
+        memcpy(&state->buffer[state->buffered], p, fill);
+        consume_stripes(state, state->buffer, 32);
+        p += fill;
+        len -= fill;
+        state->buffered = 0;
+    }
+
+    size_t used = consume_stripes(state, p, len);
+    memcpy(state->buffer, &p[used], len - used);
+    state->buffered = len - used;
+}
+
+uint64_t hash_digest(const hash_state *state) {
+    const unsigned char *p = state->buffer;
+    size_t len = state->buffered;
+    uint64_t h;
+
+    if(state->total_len >= 32) {
+        const uint64_t *v = state->acc;
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for(int i = 0; i < 4; i++)
+            h = merge_round(h, v[i]);
+    }
+    else
+        h = state->acc[2] + PRIME64_5; // acc[2] is the seed
+    h += state->total_len;
+
+    for(; len >= 8; p += 8, len -= 8) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if(len >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    for(; len > 0; p++, len--) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash_buffer(const void *data, size_t len, uint64_t seed) {
+    hash_state state;
+    hash_init(&state, seed);
+    hash_update(&state, data, len);
+    return hash_digest(&state);
+}
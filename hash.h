@@ -0,0 +1,26 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming XXH64, a fast non-cryptographic 64-bit hash that runs at memory speed. Data can be fed in pieces
+ * of any size and gives the same digest as hashing it in one go, so it can be computed on the blocks that
+ * are read anyway. Digests are compatible with other XXH64 implementations.
+ */
+typedef struct hash_state_t {
+    uint64_t acc[4];
+    uint64_t total_len;
+    unsigned char buffer[32];        // Input not yet consumed, less than one stripe
+    size_t buffered;
+} hash_state;
+
+void hash_init(hash_state *state, uint64_t seed);
+void hash_update(hash_state *state, const void *data, size_t len);
+uint64_t hash_digest(const hash_state *state);
+
+//! Hash a buffer in one go
+uint64_t hash_buffer(const void *data, size_t len, uint64_t seed);
+
+#endif /* HASH_H_ */
@@ -0,0 +1,865 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "system_shims.h"
+#include "io_pipeline.h"
+#include "uring.h"
+#include "trace.h"
+
+#if defined(HAVE_IO_URING)
+    #include <sys/uio.h>
+
+    #define URING_ENTRIES (256) // Also the cap on requests in flight, so the completion queue can't overflow
+#endif
+
+/*! Bounded single-producer/single-consumer ring of fixed-size slots. head and tail only ever grow; the
+ *  producer publishes a slot by advancing head and the consumer frees it by advancing tail.
+ */
+typedef struct ring_t {
+    unsigned char *data;
+    size_t *lens;               // Bytes used in each slot
+    size_t slot_size;
+    long depth;
+    long head;                  // Only written by the producer
+    long tail;                  // Only written by the consumer
+} ring;
+
+#define ring_slot(r, i) (&(r)->data[((i) % (r)->depth) * (r)->slot_size])
+#define ring_len(r, i)  ((r)->lens[(i) % (r)->depth])
+
+#if defined(HAVE_IO_URING)
+/*! A read or write handed to the kernel. Every ring slot has its own, so a completion says which slot
+ *  finished. Requests can complete out of order but slots are published in ring order.
+ */
+typedef struct io_request_t {
+    struct stream_t *st;
+    bool is_write;
+    bool complete;
+    long slot;
+    long long offset;           // File offset of the slot's first byte
+    size_t len;                 // Bytes to transfer
+    size_t done;                // Bytes transferred so far
+    struct iovec iov;
+} io_request;
+#endif
+
+typedef struct stream_t {
+    block_reader reader;
+    block_writer writer;
+    io_pipeline *pipe;
+    FILE *in;
+    FILE *out;
+    long long in_remaining;     // Bytes the reader thread has yet to read
+
+    ring input;                 // Reader thread -> encoder
+    ring output;                // Encoder -> writer thread
+    bool holding;               // Encoder still holds the input slot it was handed last
+
+    long eof;                   // Reader thread has published the last block
+    bool read_failed;           // Set before eof is published, when the input ended on a failed read
+    long cancelled;             // Encoder closed its reader before the end of the file
+    long closing;               // Encoder has committed its last block
+    long write_failed;
+    long encoder_waiting;
+    pthread_cond_t cond_var;    // Wakes the encoder, waited on with the pipeline mutex
+
+    // Guarded by the pipeline mutex
+    bool reader_done;           // The reader thread won't touch this stream again
+    bool writer_done;           // Nor will the writer thread
+    int  handles;               // Open block_reader/block_writer handles
+    struct stream_t *next_read;
+    struct stream_t *next_write;
+
+#if defined(HAVE_IO_URING)
+    // io_uring engine state, only touched by the I/O thread once the stream is registered
+    int in_fd;
+    int out_fd;
+    long long read_offset;      // File offset of the next block to request
+    long long read_end;
+    long long write_offset;
+    long reads_issued;          // Input slots requested so far
+    bool read_truncated;        // A read came back short, so no more slots are published
+    long writes_issued;         // Output slots requested so far
+    int reads_in_flight;
+    int writes_in_flight;
+    io_request *read_reqs;      // One per input slot
+    io_request *write_reqs;     // One per output slot
+#endif
+} stream;
+
+struct io_pipeline_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t stage_cv;    // Wakes the I/O threads, waited on with the mutex
+    long stages_waiting;        // I/O threads asleep on stage_cv
+    bool shutdown;
+    bool use_uring;
+
+    stream *read_list;          // Streams the reader thread still has work for
+    stream *write_list;         // Streams the writer thread still has work for
+
+    int read_depth;
+    int write_depth;
+    pthread_t reader;           // Also the only I/O thread with io_uring
+    pthread_t writer;
+
+#if defined(HAVE_IO_URING)
+    uring ring;
+    bool broken;                // io_uring_enter() failed, nothing reaches the kernel any more
+    int in_flight;              // Requests the kernel hasn't completed, only touched by the I/O thread
+    long requests;
+    long submit_calls;
+#endif
+
+    long blocks_read;           // Only written by the reader thread
+    long blocks_written;        // Only written by the writer thread
+    long reader_idle;
+    long writer_idle;
+    long input_waits;           // Times an encoder found its input ring empty
+    long output_waits;          // Times an encoder found its output ring full
+};
+
+/*****************************************************************************************
+* Helpers
+****************************************************************************************/
+static bool ring_init(ring *r, long depth, size_t slot_size) {
+    r->data = malloc(depth * slot_size);
+    r->lens = calloc(depth, sizeof(size_t));
+    r->slot_size = slot_size;
+    r->depth = depth;
+    r->head = 0;
+    r->tail = 0;
+    return (r->data != NULL && r->lens != NULL);
+}
+
+static void ring_free(ring *r) {
+    free(r->data);
+    free(r->lens);
+}
+
+/*! Wake the threads that may be sleeping on cv. The caller must have published its progress first; the
+ *  fence pairs with the one in encoder_wait() and the I/O threads so that either the sleeper sees the
+ *  progress or we see that it is waiting.
+ */
+static void wake(io_pipeline *pipe, long *waiting, pthread_cond_t *cv) {
+    atomic_fence();
+    if(atomic_load_acquire(waiting)) {
+        pthread_mutex_lock(&pipe->mutex);
+        pthread_cond_broadcast(cv);
+        pthread_mutex_unlock(&pipe->mutex);
+    }
+}
+
+#define wake_stages(pipe) wake((pipe), &(pipe)->stages_waiting, &(pipe)->stage_cv)
+
+/*! Sleep on the reader or writer thread side unless next_stream(pipe), re-run once the encoders can see
+ *  we're waiting, turns up a stream to work on. Called with the mutex held.
+ */
+static stream *stage_wait(io_pipeline *pipe, stream *(*next_stream)(io_pipeline *), long *idle) {
+    stream *work;
+
+    atomic_fetch_add(&pipe->stages_waiting, 1);
+    atomic_fence();
+    if((work = next_stream(pipe)) == NULL) {
+        (*idle)++;
+        pthread_cond_wait(&pipe->stage_cv, &pipe->mutex);
+    }
+    atomic_fetch_add(&pipe->stages_waiting, -1);
+    return work;
+}
+
+//! Sleep on the encoder side until ready(st) holds
+static void encoder_wait(stream *st, bool (*ready)(stream *)) {
+    io_pipeline *pipe = st->pipe;
+
+    stage_begin(STAGE_WAIT);
+    pthread_mutex_lock(&pipe->mutex);
+    atomic_store_release(&st->encoder_waiting, 1);
+    atomic_fence();
+    while(!ready(st))
+        pthread_cond_wait(&st->cond_var, &pipe->mutex);
+    atomic_store_release(&st->encoder_waiting, 0);
+    pthread_mutex_unlock(&pipe->mutex);
+    stage_end();
+}
+
+static bool input_ready(stream *st) {
+    return atomic_load_acquire(&st->input.head) != st->input.tail || atomic_load_acquire(&st->eof);
+}
+
+static bool output_ready(stream *st) {
+    return st->output.head - atomic_load_acquire(&st->output.tail) < st->output.depth;
+}
+
+static bool output_drained(stream *st) {
+    return atomic_load_acquire(&st->output.tail) == st->output.head;
+}
+
+static bool reader_done(stream *st) {
+    return st->reader_done;
+}
+
+static bool writer_done(stream *st) {
+    return st->writer_done;
+}
+
+static void release_handle(stream *st) {
+    io_pipeline *pipe = st->pipe;
+
+    pthread_mutex_lock(&pipe->mutex);
+    bool last = (--st->handles == 0);
+    pthread_mutex_unlock(&pipe->mutex);
+
+    if(last) {
+        pthread_cond_destroy(&st->cond_var);
+        ring_free(&st->input);
+        ring_free(&st->output);
+#if defined(HAVE_IO_URING)
+        free(st->read_reqs);
+        free(st->write_reqs);
+#endif
+        free(st);
+    }
+}
+
+/*****************************************************************************************
+* Reader thread
+****************************************************************************************/
+/*! Pick the next stream with a free input slot, rotating it to the back of the list so streams take turns.
+ *  Streams the reader is finished with are retired on the way. Called with the mutex held.
+ */
+static stream *next_to_read(io_pipeline *pipe) {
+    stream **link = &pipe->read_list;
+
+    while(*link != NULL) {
+        stream *st = *link;
+
+        if(atomic_load_acquire(&st->eof) || atomic_load_acquire(&st->cancelled)) {
+            *link = st->next_read;
+            st->reader_done = true;
+            pthread_cond_signal(&st->cond_var);
+        }
+        else if(st->input.head - atomic_load_acquire(&st->input.tail) < st->input.depth) {
+            *link = st->next_read;
+            while(*link != NULL)
+                link = &(*link)->next_read;
+            *link = st;
+            st->next_read = NULL;
+            return st;
+        }
+        else
+            link = &st->next_read;
+    }
+    return NULL;
+}
+
+static void *reader_main(void *arg) {
+    io_pipeline *pipe = arg;
+
+    pthread_mutex_lock(&pipe->mutex);
+    while(1) {
+        stream *st = next_to_read(pipe);
+
+        if(st == NULL) {
+            if(pipe->shutdown)
+                break;
+
+            if((st = stage_wait(pipe, next_to_read, &pipe->reader_idle)) == NULL)
+                continue;
+        }
+        pthread_mutex_unlock(&pipe->mutex);
+
+        ring *r = &st->input;
+        size_t want = (size_t)MIN((long long)r->slot_size, st->in_remaining);
+        size_t len = fread(ring_slot(r, r->head), 1, want, st->in);
+        st->in_remaining -= len;
+        ring_len(r, r->head) = len;
+        if(len > 0)
+            atomic_store_release(&r->head, r->head + 1);
+        if(len < want && ferror(st->in))
+            st->read_failed = true;
+        if(len < want || st->in_remaining == 0)
+            atomic_store_release(&st->eof, 1);
+        pipe->blocks_read++;
+        wake(pipe, &st->encoder_waiting, &st->cond_var);
+
+        pthread_mutex_lock(&pipe->mutex);
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+
+    return NULL;
+}
+
+/*****************************************************************************************
+* Writer thread
+****************************************************************************************/
+//! Pick the next stream with output to write, retiring closed streams once they are drained. Called with the mutex held.
+static stream *next_to_write(io_pipeline *pipe) {
+    stream **link = &pipe->write_list;
+
+    while(*link != NULL) {
+        stream *st = *link;
+        bool closing = atomic_load_acquire(&st->closing); // Published after the final commit, so load it first
+        bool pending = (atomic_load_acquire(&st->output.head) != st->output.tail);
+
+        if(pending) {
+            *link = st->next_write;
+            while(*link != NULL)
+                link = &(*link)->next_write;
+            *link = st;
+            st->next_write = NULL;
+            return st;
+        }
+        else if(closing) {
+            *link = st->next_write;
+            st->writer_done = true;
+            pthread_cond_signal(&st->cond_var);
+        }
+        else
+            link = &st->next_write;
+    }
+    return NULL;
+}
+
+static void *writer_main(void *arg) {
+    io_pipeline *pipe = arg;
+
+    pthread_mutex_lock(&pipe->mutex);
+    while(1) {
+        stream *st = next_to_write(pipe);
+
+        if(st == NULL) {
+            if(pipe->shutdown)
+                break;
+
+            if((st = stage_wait(pipe, next_to_write, &pipe->writer_idle)) == NULL)
+                continue;
+        }
+        pthread_mutex_unlock(&pipe->mutex);
+
+        ring *r = &st->output;
+        size_t len = ring_len(r, r->tail);
+        if(len > 0 && !atomic_load_acquire(&st->write_failed) && fwrite(ring_slot(r, r->tail), len, 1, st->out) != 1)
+            atomic_store_release(&st->write_failed, 1);
+        atomic_store_release(&r->tail, r->tail + 1);
+        pipe->blocks_written++;
+        wake(pipe, &st->encoder_waiting, &st->cond_var);
+
+        pthread_mutex_lock(&pipe->mutex);
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+
+    return NULL;
+}
+
+#if defined(HAVE_IO_URING)
+/*****************************************************************************************
+* io_uring engine
+*
+* A single I/O thread replaces the reader and writer threads. It keeps every free input slot of every
+* stream requested from the kernel, so each file has up to read_depth reads in flight, queues a write for
+* every committed output slot, and hands the whole batch over in one io_uring_enter() call.
+****************************************************************************************/
+static void prep_request(io_pipeline *pipe, io_request *req) {
+    if(pipe->broken) // Left in flight for fail_requests()
+        return;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(&pipe->ring); // Can't fail, in_flight never exceeds the ring size
+    stream *st = req->st;
+    ring *r = req->is_write ? &st->output : &st->input;
+
+    req->iov.iov_base = ring_slot(r, req->slot) + req->done;
+    req->iov.iov_len = req->len - req->done;
+    sqe->opcode = req->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = req->is_write ? st->out_fd : st->in_fd;
+    sqe->addr = (unsigned long)&req->iov;
+    sqe->len = 1;
+    sqe->off = req->offset + req->done;
+    sqe->user_data = (unsigned long)req;
+}
+
+/*! Publish the input slots that have been read, in order, and flag the end of the stream once it is reached.
+ *  Only the bytes a read actually returned are published, and nothing after a read that came back short,
+ *  as the slots behind it don't follow on from its data.
+ */
+static void publish_reads(io_pipeline *pipe, stream *st) {
+    ring *r = &st->input;
+
+    while(!st->read_truncated && r->head < st->reads_issued && st->read_reqs[r->head % r->depth].complete) {
+        io_request *req = &st->read_reqs[r->head % r->depth];
+        req->complete = false;
+        st->read_truncated = (req->done < req->len);
+        if(req->done == 0)
+            break;
+        ring_len(r, r->head) = req->done;
+        atomic_store_release(&r->head, r->head + 1);
+        pipe->blocks_read++;
+    }
+    if(st->read_truncated || (st->read_offset >= st->read_end && r->head == st->reads_issued))
+        atomic_store_release(&st->eof, 1);
+}
+
+//! Free the output slots that have been written, in order
+static void retire_writes(io_pipeline *pipe, stream *st) {
+    ring *r = &st->output;
+
+    while(r->tail < st->writes_issued && st->write_reqs[r->tail % r->depth].complete) {
+        st->write_reqs[r->tail % r->depth].complete = false;
+        atomic_store_release(&r->tail, r->tail + 1);
+        pipe->blocks_written++;
+    }
+}
+
+/*! Queue requests for every stream with free input slots or committed output, and retire streams the I/O
+ *  thread is finished with. Called with the mutex held. Returns the number of requests queued.
+ */
+static long queue_requests(io_pipeline *pipe) {
+    long queued = 0;
+    stream **link = &pipe->read_list;
+
+    while(*link != NULL) {
+        stream *st = *link;
+        ring *r = &st->input;
+
+        if(atomic_load_acquire(&st->eof) || atomic_load_acquire(&st->cancelled)) {
+            if(st->reads_in_flight == 0) { // The kernel may still be filling slots after a cancel
+                *link = st->next_read;
+                st->reader_done = true;
+                pthread_cond_signal(&st->cond_var);
+                continue;
+            }
+        }
+        else {
+            while(st->read_offset < st->read_end && st->reads_issued - atomic_load_acquire(&r->tail) < r->depth &&
+                  pipe->in_flight < URING_ENTRIES) {
+                io_request *req = &st->read_reqs[st->reads_issued % r->depth];
+                req->slot = st->reads_issued++;
+                req->offset = st->read_offset;
+                req->len = MIN((long long)r->slot_size, st->read_end - st->read_offset);
+                req->done = 0;
+                st->read_offset += req->len;
+
+                prep_request(pipe, req);
+                st->reads_in_flight++;
+                pipe->in_flight++;
+                queued++;
+            }
+        }
+        link = &st->next_read;
+    }
+
+    link = &pipe->write_list;
+    while(*link != NULL) {
+        stream *st = *link;
+        ring *r = &st->output;
+        bool closing = atomic_load_acquire(&st->closing); // Published after the final commit, so load it first
+        long head = atomic_load_acquire(&r->head);
+        bool progress = false;
+
+        while(st->writes_issued < head && pipe->in_flight < URING_ENTRIES) {
+            io_request *req = &st->write_reqs[st->writes_issued % r->depth];
+            req->slot = st->writes_issued++;
+            req->offset = st->write_offset;
+            req->len = ring_len(r, req->slot);
+            req->done = 0;
+            st->write_offset += req->len;
+
+            if(req->len == 0 || atomic_load_acquire(&st->write_failed)) {
+                req->complete = true; // Nothing to write, or no point any more
+                progress = true;
+                continue;
+            }
+            prep_request(pipe, req);
+            st->writes_in_flight++;
+            pipe->in_flight++;
+            queued++;
+        }
+
+        if(progress) {
+            retire_writes(pipe, st);
+            pthread_cond_signal(&st->cond_var);
+        }
+
+        if(closing && st->writes_issued == head && st->writes_in_flight == 0) {
+            *link = st->next_write;
+            st->writer_done = true;
+            pthread_cond_signal(&st->cond_var);
+        }
+        else
+            link = &st->next_write;
+    }
+
+    pipe->requests += queued;
+    return queued;
+}
+
+static void complete_request(io_pipeline *pipe, io_request *req, int res) {
+    stream *st = req->st;
+
+    if(res > 0) {
+        req->done += res;
+        if(req->done < req->len) { // Short transfer, ask for the rest
+            prep_request(pipe, req);
+            return;
+        }
+    }
+    pipe->in_flight--;
+    req->complete = true;
+
+    if(req->is_write) {
+        if(req->done < req->len)
+            atomic_store_release(&st->write_failed, 1);
+        st->writes_in_flight--;
+        retire_writes(pipe, st);
+    }
+    else {
+        if(req->done < req->len)
+            st->read_failed = true;
+        st->reads_in_flight--;
+        publish_reads(pipe, st);
+    }
+    wake(pipe, &st->encoder_waiting, &st->cond_var);
+}
+
+/*! Complete every request of the given streams that is still in flight as failed, once the engine is broken.
+ *  Streams are only ever added to the front of the lists, so the ones passed in can be walked without the
+ *  mutex, which complete_request() may take.
+ */
+static void fail_requests(io_pipeline *pipe, stream *reads, stream *writes) {
+    for(stream *st = reads; st != NULL; st = st->next_read) {
+        for(long slot = st->input.head; slot < st->reads_issued; slot++) {
+            io_request *req = &st->read_reqs[slot % st->input.depth];
+            if(!req->complete)
+                complete_request(pipe, req, -EIO);
+        }
+    }
+    for(stream *st = writes; st != NULL; st = st->next_write) {
+        for(long slot = st->output.tail; slot < st->writes_issued; slot++) {
+            io_request *req = &st->write_reqs[slot % st->output.depth];
+            if(!req->complete)
+                complete_request(pipe, req, -EIO);
+        }
+    }
+}
+
+static void *uring_main(void *arg) {
+    io_pipeline *pipe = arg;
+
+    pthread_mutex_lock(&pipe->mutex);
+    while(1) {
+        long queued = queue_requests(pipe);
+
+        if(queued == 0 && pipe->in_flight == 0) {
+            if(pipe->shutdown)
+                break;
+
+            atomic_fetch_add(&pipe->stages_waiting, 1);
+            atomic_fence();
+            if((queued = queue_requests(pipe)) == 0) {
+                pipe->reader_idle++;
+                pthread_cond_wait(&pipe->stage_cv, &pipe->mutex);
+            }
+            atomic_fetch_add(&pipe->stages_waiting, -1);
+            if(queued == 0)
+                continue;
+        }
+        if(pipe->broken) {
+            stream *reads = pipe->read_list, *writes = pipe->write_list;
+            pthread_mutex_unlock(&pipe->mutex);
+            fail_requests(pipe, reads, writes);
+            pthread_mutex_lock(&pipe->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&pipe->mutex);
+
+        // Submit everything queued and sleep until at least one request completes
+        if(uring_submit(&pipe->ring, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // Fail the jobs using the engine, and any that would, rather than take the whole batch down
+            perror("io_uring_enter");
+            pthread_mutex_lock(&pipe->mutex);
+            pipe->broken = true;
+            pthread_mutex_unlock(&pipe->mutex);
+        }
+        else if(queued > 0)
+            pipe->submit_calls++;
+
+        struct io_uring_cqe *cqe;
+        while((cqe = uring_peek(&pipe->ring)) != NULL) {
+            io_request *req = (io_request *)(unsigned long)cqe->user_data;
+            int res = cqe->res;
+
+            uring_seen(&pipe->ring);
+            complete_request(pipe, req, res);
+        }
+
+        pthread_mutex_lock(&pipe->mutex);
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+
+    return NULL;
+}
+
+//! Set up the io_uring state of a new stream. Reads and writes go to explicit offsets, starting where in
+//! and out are positioned now, so nothing must go through the FILEs while the stream is open.
+static bool uring_open(stream *st) {
+    struct stat info;
+
+    st->write_reqs = calloc(st->output.depth, sizeof(io_request));
+    st->read_reqs = calloc(st->input.depth, sizeof(io_request));
+    if(st->write_reqs == NULL || st->read_reqs == NULL)
+        return false;
+
+    for(long i = 0; i < st->output.depth; i++) {
+        st->write_reqs[i].st = st;
+        st->write_reqs[i].is_write = true;
+    }
+    st->out_fd = fileno(st->out);
+    st->write_offset = ftell(st->out);
+
+    if(st->in != NULL) {
+        for(long i = 0; i < st->input.depth; i++)
+            st->read_reqs[i].st = st;
+        st->in_fd = fileno(st->in);
+        st->read_offset = ftell(st->in);
+        if(fstat(st->in_fd, &info) != 0 || st->read_offset < 0)
+            return false;
+        st->read_end = MIN((long long)info.st_size, st->read_offset + st->in_remaining);
+        if(st->read_offset >= st->read_end)
+            st->eof = 1;
+    }
+    return (st->write_offset >= 0);
+}
+#endif /* HAVE_IO_URING */
+
+/*****************************************************************************************
+* Encoder side
+****************************************************************************************/
+static size_t pipe_next(block_reader *reader, const unsigned char **block) {
+    stream *st = (stream *)reader;
+    ring *r = &st->input;
+
+    if(st->holding) { // Hand the previous slot back to the reader thread
+        atomic_store_release(&r->tail, r->tail + 1);
+        st->holding = false;
+        wake_stages(st->pipe);
+    }
+
+    if(!input_ready(st)) {
+        atomic_fetch_add(&st->pipe->input_waits, 1);
+        encoder_wait(st, input_ready);
+    }
+
+    if(atomic_load_acquire(&r->head) == r->tail)
+        return 0; // End of file
+
+    st->holding = true;
+    *block = ring_slot(r, r->tail);
+    return ring_len(r, r->tail);
+}
+
+static bool pipe_failed(block_reader *reader) {
+    return ((stream *)reader)->read_failed; // Ordered by the load of eof that ended the stream
+}
+
+static void pipe_reader_close(block_reader *reader) {
+    stream *st = (stream *)reader;
+
+    atomic_store_release(&st->cancelled, 1); // Harmless if the reader thread already hit the end of the file
+    wake_stages(st->pipe);
+    encoder_wait(st, reader_done);
+    release_handle(st);
+}
+
+#define writer_stream(w) ((stream *)((char *)(w) - offsetof(stream, writer)))
+
+static unsigned char *pipe_reserve(block_writer *writer, size_t capacity) {
+    stream *st = writer_stream(writer);
+
+    if(capacity > st->output.slot_size)
+        return NULL;
+
+    if(!output_ready(st)) {
+        atomic_fetch_add(&st->pipe->output_waits, 1);
+        encoder_wait(st, output_ready);
+    }
+    return ring_slot(&st->output, st->output.head);
+}
+
+static bool pipe_commit(block_writer *writer, size_t len) {
+    stream *st = writer_stream(writer);
+    ring *r = &st->output;
+
+    ring_len(r, r->head) = len;
+    atomic_store_release(&r->head, r->head + 1);
+    wake_stages(st->pipe);
+
+    return !atomic_load_acquire(&st->write_failed);
+}
+
+static bool pipe_write_at(block_writer *writer, long offset, const unsigned char *data, size_t len) {
+    stream *st = writer_stream(writer);
+
+    encoder_wait(st, output_drained); // The writer thread leaves the file alone until the next commit
+    if(fseek(st->out, offset, SEEK_SET) != 0 || fwrite(data, len, 1, st->out) != 1)
+        atomic_store_release(&st->write_failed, 1);
+    fseek(st->out, 0, SEEK_END);
+
+    return !atomic_load_acquire(&st->write_failed);
+}
+
+static bool pipe_writer_close(block_writer *writer) {
+    stream *st = writer_stream(writer);
+
+    atomic_store_release(&st->closing, 1);
+    wake_stages(st->pipe);
+    encoder_wait(st, writer_done);
+
+    bool ok = !atomic_load_acquire(&st->write_failed);
+    release_handle(st);
+    return ok;
+}
+
+/*****************************************************************************************
+* Setup
+****************************************************************************************/
+io_pipeline *pipeline_create(int read_depth, int write_depth, bool use_io_uring) {
+    io_pipeline *pipe = calloc(1, sizeof(io_pipeline));
+    if(pipe == NULL)
+        return NULL;
+
+    pipe->read_depth = MAX(read_depth, 1);
+    pipe->write_depth = MAX(write_depth, 1);
+
+    if(use_io_uring) {
+#if defined(HAVE_IO_URING)
+        pipe->use_uring = uring_init(&pipe->ring, URING_ENTRIES);
+#endif
+        if(!pipe->use_uring) {
+            free(pipe);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&pipe->mutex, NULL);
+    pthread_cond_init(&pipe->stage_cv, NULL);
+
+#if defined(HAVE_IO_URING)
+    if(pipe->use_uring) {
+        pthread_create(&pipe->reader, NULL, uring_main, pipe);
+        return pipe;
+    }
+#endif
+    pthread_create(&pipe->reader, NULL, reader_main, pipe);
+    pthread_create(&pipe->writer, NULL, writer_main, pipe);
+
+    return pipe;
+}
+
+bool pipeline_open(io_pipeline *pipe, FILE *in, long long in_len, FILE *out, size_t in_block_size,
+                   size_t out_block_size, block_reader **reader, block_writer **writer) {
+    stream *st = calloc(1, sizeof(stream));
+    if(st == NULL)
+        return false;
+
+    if(!ring_init(&st->input, (in != NULL) ? pipe->read_depth : 1, in_block_size) ||
+       !ring_init(&st->output, pipe->write_depth, out_block_size)) {
+        ring_free(&st->input);
+        ring_free(&st->output);
+        free(st);
+        return false;
+    }
+
+    st->reader.next = pipe_next;
+    st->reader.failed = pipe_failed;
+    st->reader.close = pipe_reader_close;
+    st->writer.reserve = pipe_reserve;
+    st->writer.commit = pipe_commit;
+    st->writer.write_at = pipe_write_at;
+    st->writer.close = pipe_writer_close;
+    st->pipe = pipe;
+    st->in = in;
+    st->out = out;
+    st->in_remaining = in_len;
+    st->handles = (in != NULL) ? 2 : 1;
+    st->reader_done = (in == NULL);
+
+#if defined(HAVE_IO_URING)
+    if(pipe->use_uring && !uring_open(st)) {
+        free(st->read_reqs);
+        free(st->write_reqs);
+        ring_free(&st->input);
+        ring_free(&st->output);
+        free(st);
+        return false;
+    }
+#endif
+    pthread_cond_init(&st->cond_var, NULL);
+
+    pthread_mutex_lock(&pipe->mutex);
+#if defined(HAVE_IO_URING)
+    if(pipe->broken) {
+        pthread_mutex_unlock(&pipe->mutex);
+        pthread_cond_destroy(&st->cond_var);
+        free(st->read_reqs);
+        free(st->write_reqs);
+        ring_free(&st->input);
+        ring_free(&st->output);
+        free(st);
+        return false;
+    }
+#endif
+    if(in != NULL) {
+        st->next_read = pipe->read_list;
+        pipe->read_list = st;
+    }
+    st->next_write = pipe->write_list;
+    pipe->write_list = st;
+    pthread_cond_broadcast(&pipe->stage_cv);
+    pthread_mutex_unlock(&pipe->mutex);
+
+    if(in != NULL)
+        *reader = &st->reader;
+    *writer = &st->writer;
+    return true;
+}
+
+void pipeline_report(io_pipeline *pipe) {
+    pthread_mutex_lock(&pipe->mutex);
+    printf("I/O pipeline: read-ahead %d blocks, write-behind %d blocks per file\n",
+           pipe->read_depth, pipe->write_depth);
+    printf("  %ld blocks read, %ld blocks written\n", pipe->blocks_read, pipe->blocks_written);
+    printf("  encoders waited %ld times for input and %ld times for output space\n",
+           atomic_load_acquire(&pipe->input_waits), atomic_load_acquire(&pipe->output_waits));
+#if defined(HAVE_IO_URING)
+    if(pipe->use_uring) {
+        printf("  io_uring: %ld requests in %ld submissions, I/O thread idled %ld times\n",
+               pipe->requests, pipe->submit_calls, pipe->reader_idle);
+        pthread_mutex_unlock(&pipe->mutex);
+        return;
+    }
+#endif
+    printf("  reader idled %ld times, writer idled %ld times\n", pipe->reader_idle, pipe->writer_idle);
+    pthread_mutex_unlock(&pipe->mutex);
+}
+
+void pipeline_destroy(io_pipeline *pipe) {
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->shutdown = true;
+    pthread_cond_broadcast(&pipe->stage_cv);
+    pthread_mutex_unlock(&pipe->mutex);
+
+    pthread_join(pipe->reader, NULL);
+    if(!pipe->use_uring)
+        pthread_join(pipe->writer, NULL);
+
+#if defined(HAVE_IO_URING)
+    if(pipe->use_uring)
+        uring_exit(&pipe->ring);
+#endif
+    pthread_mutex_destroy(&pipe->mutex);
+    pthread_cond_destroy(&pipe->stage_cv);
+    free(pipe);
+}
@@ -0,0 +1,38 @@
+#ifndef IO_PIPELINE_H_
+#define IO_PIPELINE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "block_io.h"
+
+/*
+ * Three-stage read/encode/write pipeline. A dedicated reader thread prefetches PCM blocks for every open
+ * stream and a dedicated writer thread drains their MP3 output, so encoding threads only run LAME. Each
+ * stream moves blocks through two bounded single-producer/single-consumer rings; the data path is
+ * lock-free and the shared mutex is only taken when one side has to sleep or wake the other.
+ *
+ * On Linux the reader and writer threads can be replaced by a single io_uring thread, which keeps
+ * read_depth reads in flight per stream and submits the requests of all streams in one system call.
+ */
+typedef struct io_pipeline_t io_pipeline;
+
+//! Start the reader and writer threads. read_depth and write_depth are the ring sizes per stream, in blocks.
+//! With use_io_uring the I/O goes through io_uring instead, and NULL is returned if it isn't available.
+io_pipeline *pipeline_create(int read_depth, int write_depth, bool use_io_uring);
+
+//! Register a job with the pipeline. Its reader yields blocks of in_block_size bytes read from in, up to
+//! in_len bytes in all, and its writer queues blocks of up to out_block_size bytes for writing to out. Both must be closed before the
+//! files are. If in is NULL only the writer is set up, for inputs that are read some other way. With
+//! io_uring the files are accessed by descriptor from their current positions, bypassing the FILE buffers.
+//! Returns false if memory runs out, or io_uring_enter() has failed, which also fails the jobs using it.
+bool pipeline_open(io_pipeline *pipe, FILE *in, long long in_len, FILE *out, size_t in_block_size,
+                   size_t out_block_size, block_reader **reader, block_writer **writer);
+
+//! Print the configured queue depths and how often each stage had to wait on another
+void pipeline_report(io_pipeline *pipe);
+
+//! Stop and join the pipeline threads. Every stream must already be closed.
+void pipeline_destroy(io_pipeline *pipe);
+
+#endif /* IO_PIPELINE_H_ */
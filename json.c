@@ -0,0 +1,16 @@
+#include <stdio.h>
+
+#include "json.h"
+
+void json_write_string(FILE *file, const char *s) {
+    fputc('"', file);
+    for(; *s != '\0'; s++) {
+        if(*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if((unsigned char)*s < 0x20)
+            fprintf(file, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
@@ -0,0 +1,13 @@
+#ifndef JSON_H_
+#define JSON_H_
+
+#include <stdio.h>
+
+/*
+ * The bits of JSON output shared by the trace and the report
+ */
+
+//! Write s as a quoted JSON string, escaping quotes, backslashes and control characters
+void json_write_string(FILE *file, const char *s);
+
+#endif /* JSON_H_ */
@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "system_shims.h"
+#include "hash.h"
+#include "filesystem_access.h"
+#include "manifest.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define MANIFEST_LINE (2 * INITIAL_SYS_PATH_LEN + 256) // Longest record read back; longer ones are dropped
+#define MAX_SETTINGS  (64)
+#define HASH_BLOCK    (256 * 1024)                     // Read size when hashing a WAV's PCM data
+
+typedef struct record_t {
+    char *path;                      // MP3 path relative to the output dir, NULL for an empty slot
+    source_stamp source;
+    uint64_t hash;
+    bool has_hash;
+    long long out_size;
+    char settings[MAX_SETTINGS];
+} record;
+
+struct manifest_t {
+    pthread_mutex_t mutex;           // Guards everything below
+    record *records;                 // Open addressing hash table keyed by path
+    size_t count;
+    size_t capacity;                 // Always a power of two
+
+    FILE *log;                       // The manifest file, records are appended as jobs finish
+    char *file_path;
+    size_t root_len;                 // Length of the output dir prefix stripped from MP3 paths
+    char settings[MAX_SETTINGS];
+    bool use_hash;
+
+    long up_to_date;
+    long rehashed;                   // Up to date by content after the mtime changed
+};
+
+bool stat_file(const char *path, source_stamp *stamp) {
+#if defined(_WIN32)
+    struct _stat64 st;
+    if(_stat64(path, &st) != 0)
+        return false;
+    stamp->mtime = (long long)st.st_mtime * 1000000000LL;
+#else
+    struct stat st;
+    if(stat(path, &st) != 0)
+        return false;
+    stamp->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    stamp->size = (long long)st.st_size;
+    return true;
+}
+
+/*! XXH64, seed 0, of the PCM data of a WAV, up to the end of the file if it is truncated: the bytes encode()
+ *  reads. Returns false if the file can't be read or parsed.
+ */
+static bool hash_pcm(const char *path, uint64_t *digest) {
+    FILE *file = fopen(path, "rb");
+    unsigned char *block = malloc(HASH_BLOCK);
+    wav_header fmt;
+    hash_state state;
+    bool ok = (file != NULL && block != NULL && !parse_wav(&fmt, file)); // Leaves file at the PCM data
+
+    hash_init(&state, 0);
+    for(long long remaining = ok ? fmt.data_len : 0; ok && remaining > 0; ) {
+        size_t len = fread(block, 1, (size_t)MIN((long long)HASH_BLOCK, remaining), file);
+        if(len == 0)
+            break;
+        hash_update(&state, block, len);
+        remaining -= len;
+    }
+    ok = ok && !ferror(file);
+
+    if(file != NULL)
+        fclose(file);
+    free(block);
+    *digest = hash_digest(&state);
+    return ok;
+}
+
+/*****************************************************************************************
+* Record table
+****************************************************************************************/
+static record *find_slot(record *records, size_t capacity, const char *path) {
+    size_t i = (size_t)hash_buffer(path, strlen(path), 0) & (capacity - 1);
+
+    while(records[i].path != NULL && strcmp(records[i].path, path) != 0)
+        i = (i + 1) & (capacity - 1);
+    return &records[i];
+}
+
+//! Insert or replace a record, taking ownership of rec.path. Called with the mutex held.
+static void upsert(manifest *m, record rec) {
+    if(2 * (m->count + 1) > m->capacity) { // Keep the load factor at or below one half
+        size_t capacity = MAX(1024, 2 * m->capacity);
+        record *tmp = calloc(capacity, sizeof(record));
+        if(tmp == NULL) {
+            free(rec.path);
+            return;
+        }
+        for(size_t i = 0; i < m->capacity; i++) {
+            if(m->records[i].path != NULL)
+                *find_slot(tmp, capacity, m->records[i].path) = m->records[i];
+        }
+        free(m->records);
+        m->records = tmp;
+        m->capacity = capacity;
+    }
+
+    record *slot = find_slot(m->records, m->capacity, rec.path);
+    if(slot->path != NULL)
+        free(slot->path);
+    else
+        m->count++;
+    *slot = rec;
+}
+
+static void write_record(FILE *file, const record *rec) {
+    if(rec->has_hash)
+        fprintf(file, "%lld %lld %016llx %lld %s %s\n", rec->source.size, rec->source.mtime,
+                (unsigned long long)rec->hash, rec->out_size, rec->settings, rec->path);
+    else
+        fprintf(file, "%lld %lld - %lld %s %s\n", rec->source.size, rec->source.mtime, rec->out_size,
+                rec->settings, rec->path);
+}
+
+//! Parse one line of the manifest file. Returns false for malformed lines.
+static bool parse_record(char *line, record *rec) {
+    char hash[17];
+    int path_start = 0;
+
+    memset(rec, 0, sizeof(record));
+    if(sscanf(line, "%lld %lld %16s %lld %63s %n", &rec->source.size, &rec->source.mtime, hash, &rec->out_size,
+              rec->settings, &path_start) != 5 || path_start == 0)
+        return false;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if(line[path_start] == '\0')
+        return false;
+
+    rec->has_hash = (strcmp(hash, "-") != 0);
+    if(rec->has_hash) {
+        char *end;
+        rec->hash = strtoull(hash, &end, 16);
+        if(*end != '\0')
+            return false;
+    }
+
+    rec->path = strdup(&line[path_start]);
+    return rec->path != NULL;
+}
+
+//! MP3 path as recorded, relative to the output dir if it is inside it
+static const char *relative_path(manifest *m, const char *out_path) {
+    bool inside = (strlen(out_path) > m->root_len && strncmp(out_path, m->file_path, m->root_len) == 0);
+    return inside ? &out_path[m->root_len] : out_path;
+}
+
+//! Add a record for out_path to the table and the file. hash may be NULL.
+static void store(manifest *m, const char *out_path, const source_stamp *stamp, const uint64_t *hash) {
+    source_stamp out;
+    record rec = { .path = strdup(relative_path(m, out_path)), .source = *stamp,
+                   .hash = hash ? *hash : 0, .has_hash = (hash != NULL) };
+
+    if(rec.path == NULL || strpbrk(rec.path, "\r\n") != NULL || !stat_file(out_path, &out)) {
+        free(rec.path);
+        return;
+    }
+    rec.out_size = out.size;
+    snprintf(rec.settings, MAX_SETTINGS, "%s", m->settings);
+
+    pthread_mutex_lock(&m->mutex);
+    write_record(m->log, &rec);
+    fflush(m->log);
+    upsert(m, rec);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+/*****************************************************************************************
+* Manifest
+****************************************************************************************/
+manifest *manifest_open(filepath output_dir, const char *name, const char *settings, bool use_hash) {
+    manifest *m = calloc(1, sizeof(manifest));
+    char *line = malloc(MANIFEST_LINE);
+    if(m == NULL || line == NULL || strlen(settings) >= MAX_SETTINGS) {
+        free(m);
+        free(line);
+        return NULL;
+    }
+
+    m->file_path = get_full_path(output_dir, (filepath) { (char *)name, strlen(name) }).path;
+    m->root_len = output_dir.path_len;
+    m->use_hash = use_hash;
+    snprintf(m->settings, MAX_SETTINGS, "%s", settings);
+    pthread_mutex_init(&m->mutex, NULL);
+
+    FILE *file = (m->file_path != NULL) ? fopen(m->file_path, "rb") : NULL;
+    if(file != NULL) {
+        record rec;
+        while(fgets(line, MANIFEST_LINE, file) != NULL) {
+            if(strchr(line, '\n') == NULL && !feof(file)) { // Too long, skip the rest of it
+                int c;
+                while((c = fgetc(file)) != EOF && c != '\n');
+                continue;
+            }
+            if(parse_record(line, &rec))
+                upsert(m, rec); // Later records replace earlier ones for the same MP3
+        }
+        fclose(file);
+    }
+    free(line);
+
+    m->log = (m->file_path != NULL) ? fopen(m->file_path, "ab") : NULL;
+    if(m->log == NULL) {
+        printf("Cannot write %s\n", m->file_path ? m->file_path : name);
+        manifest_close(m);
+        return NULL;
+    }
+    return m;
+}
+
+bool manifest_up_to_date(manifest *m, const char *in_path, const char *out_path, source_stamp *stamp) {
+    source_stamp out;
+    if(!stat_file(in_path, stamp) || !stat_file(out_path, &out))
+        return false;
+
+    pthread_mutex_lock(&m->mutex);
+    record *rec = (m->capacity > 0) ? find_slot(m->records, m->capacity, relative_path(m, out_path)) : NULL;
+    bool known = (rec != NULL && rec->path != NULL && strcmp(rec->settings, m->settings) == 0 &&
+                  rec->out_size == out.size && rec->source.size == stamp->size);
+    bool same_mtime = known && rec->source.mtime == stamp->mtime;
+    bool check_hash = known && !same_mtime && m->use_hash && rec->has_hash;
+    uint64_t expected = check_hash ? rec->hash : 0;
+    if(same_mtime)
+        m->up_to_date++;
+    pthread_mutex_unlock(&m->mutex);
+
+    if(!check_hash)
+        return same_mtime;
+
+    // Touched but maybe not changed. Hash without holding the lock, and remember the new mtime if it matches.
+    uint64_t digest;
+    if(!hash_pcm(in_path, &digest) || digest != expected)
+        return false;
+
+    pthread_mutex_lock(&m->mutex);
+    m->up_to_date++;
+    m->rehashed++;
+    pthread_mutex_unlock(&m->mutex);
+    store(m, out_path, stamp, &digest);
+    return true;
+}
+
+bool manifest_hashes(manifest *m) {
+    return m->use_hash;
+}
+
+void manifest_record(manifest *m, const char *in_path, const char *out_path, const source_stamp *stamp,
+                     const uint64_t *pcm_hash) {
+    source_stamp now;
+
+    // Only trust the hash if the WAV didn't change while it was being encoded
+    bool hashed = m->use_hash && pcm_hash != NULL && stat_file(in_path, &now) &&
+                  now.size == stamp->size && now.mtime == stamp->mtime;
+    store(m, out_path, stamp, hashed ? pcm_hash : NULL);
+}
+
+void manifest_report(manifest *m) {
+    pthread_mutex_lock(&m->mutex);
+    printf("Incremental: %ld files up to date", m->up_to_date);
+    if(m->use_hash)
+        printf(", %ld of them by content", m->rehashed);
+    printf("\n");
+    pthread_mutex_unlock(&m->mutex);
+}
+
+void manifest_close(manifest *m) {
+    if(m->log != NULL) {
+        fclose(m->log);
+
+        // Rewrite the file with one record per MP3, dropping the superseded ones
+        filepath file = { m->file_path, strlen(m->file_path) };
+        filepath tmp_path = get_full_path(file, (filepath) { ".tmp", 4 });
+        FILE *tmp = (tmp_path.path != NULL) ? fopen(tmp_path.path, "wb") : NULL;
+        if(tmp != NULL) {
+            for(size_t i = 0; i < m->capacity; i++) {
+                if(m->records[i].path != NULL)
+                    write_record(tmp, &m->records[i]);
+            }
+            bool ok = (fclose(tmp) == 0);
+#if defined(_WIN32)
+            if(ok)
+                remove(m->file_path); // rename() doesn't replace existing files on Windows
+#endif
+            if(!ok || rename(tmp_path.path, m->file_path) != 0)
+                remove(tmp_path.path);
+        }
+        free(tmp_path.path);
+    }
+
+    for(size_t i = 0; i < m->capacity; i++)
+        free(m->records[i].path);
+    pthread_mutex_destroy(&m->mutex);
+    free(m->records);
+    free(m->file_path);
+    free(m);
+}
@@ -0,0 +1,52 @@
+#ifndef MANIFEST_H_
+#define MANIFEST_H_
+
+#include <stdbool.h>
+
+#include "filesystem_access.h"
+
+/*
+ * Record of the MP3s earlier runs wrote to an output dir, kept in a file inside it, for incremental
+ * runs. For every MP3 it holds the size and modification time of the WAV it was made from, the encoder
+ * settings, the size of the MP3 and optionally a hash of the WAV. A job is up to date if its MP3 still has
+ * the recorded size and its WAV still has the recorded size and mtime or, in hash mode, the same PCM data.
+ * Records are appended as jobs finish, so an interrupted run loses nothing, and the file is compacted when
+ * it is closed. All functions are thread-safe.
+ */
+#define MANIFEST_NAME ".wav2mp3-manifest"
+
+typedef struct manifest_t manifest;
+
+//! Size and modification time of a WAV, taken before it is encoded
+typedef struct source_stamp_t {
+    long long size;
+    long long mtime;                 // Nanoseconds since the epoch, or as precise as the platform gets
+} source_stamp;
+
+//! Size and modification time of a file. Returns false if it doesn't exist.
+bool stat_file(const char *path, source_stamp *stamp);
+
+//! Load the manifest called name in output_dir, usually MANIFEST_NAME, or start an empty one. settings
+//! identifies the encoder settings in use and must not contain whitespace. With use_hash, WAVs whose mtime
+//! changed but whose content didn't still count as up to date. Returns NULL on failure.
+manifest *manifest_open(filepath output_dir, const char *name, const char *settings, bool use_hash);
+
+//! Whether out_path, made from in_path, is up to date. *stamp receives the WAV's current size and mtime, to
+//! be passed to manifest_record() once the job is done.
+bool manifest_up_to_date(manifest *m, const char *in_path, const char *out_path, source_stamp *stamp);
+
+//! Whether the manifest records hashes of the WAVs' PCM data, to be taken while they are encoded
+bool manifest_hashes(manifest *m);
+
+//! Record that out_path was written from in_path as it was when stamp was taken. pcm_hash is the XXH64, seed
+//! 0, of the PCM data the encoder read, or NULL if it wasn't taken.
+void manifest_record(manifest *m, const char *in_path, const char *out_path, const source_stamp *stamp,
+                     const uint64_t *pcm_hash);
+
+//! Print how many jobs were skipped as up to date
+void manifest_report(manifest *m);
+
+//! Compact the manifest file and free the manifest
+void manifest_close(manifest *m);
+
+#endif /* MANIFEST_H_ */
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "hash.h"
+#include "path_set.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define INITIAL_BUCKETS (256) // Doubled whenever the set holds more paths than there are buckets
+
+typedef struct path_node_t {
+    struct path_node_t *next;
+    uint64_t hash;
+    bool dirty;                      // Reported again since it was added
+    char path[];
+} path_node;
+
+struct path_set_t {
+    pthread_mutex_t mutex;
+    path_node **buckets;
+    size_t n_buckets;                // A power of two
+    size_t count;
+};
+
+path_set *path_set_create(void) {
+    path_set *set = malloc(sizeof(path_set));
+    if(set == NULL)
+        return NULL;
+    if((set->buckets = calloc(INITIAL_BUCKETS, sizeof(path_node *))) == NULL) {
+        free(set);
+        return NULL;
+    }
+    set->n_buckets = INITIAL_BUCKETS;
+    set->count = 0;
+    pthread_mutex_init(&set->mutex, NULL);
+    return set;
+}
+
+//! Double the bucket count. The set keeps working with the old table if memory runs out.
+static void grow(path_set *set) {
+    size_t n_buckets = 2 * set->n_buckets;
+    path_node **buckets = calloc(n_buckets, sizeof(path_node *));
+    if(buckets == NULL)
+        return;
+
+    for(size_t i = 0; i < set->n_buckets; i++) {
+        for(path_node *node = set->buckets[i], *next; node != NULL; node = next) {
+            next = node->next;
+            node->next = buckets[node->hash & (n_buckets - 1)];
+            buckets[node->hash & (n_buckets - 1)] = node;
+        }
+    }
+    free(set->buckets);
+    set->buckets = buckets;
+    set->n_buckets = n_buckets;
+}
+
+//! Link to the node holding path, or to the end of its bucket. Called with the mutex held.
+static path_node **find(path_set *set, const char *path, uint64_t hash) {
+    path_node **link = &set->buckets[hash & (set->n_buckets - 1)];
+    while(*link != NULL && !((*link)->hash == hash && strcmp((*link)->path, path) == 0))
+        link = &(*link)->next;
+    return link;
+}
+
+bool path_set_add(path_set *set, const char *path, bool *added) {
+    size_t len = strlen(path);
+    uint64_t hash = hash_buffer(path, len, 0);
+    bool ok = true;
+
+    pthread_mutex_lock(&set->mutex);
+    path_node **link = find(set, path, hash);
+    *added = (*link == NULL);
+    if(!*added)
+        (*link)->dirty = true;
+    else if((*link = malloc(sizeof(path_node) + len + 1)) != NULL) {
+        path_node *node = *link;
+        node->next = NULL;
+        node->hash = hash;
+        node->dirty = false;
+        memcpy(node->path, path, len + 1);
+        if(++set->count > set->n_buckets)
+            grow(set);
+    }
+    else
+        ok = *added = false;
+    pthread_mutex_unlock(&set->mutex);
+    return ok;
+}
+
+//! Unlink and free the node at link. Called with the mutex held.
+static void unlink_node(path_set *set, path_node **link) {
+    path_node *node = *link;
+    *link = node->next;
+    free(node);
+    set->count--;
+}
+
+bool path_set_finish(path_set *set, const char *path) {
+    uint64_t hash = hash_buffer(path, strlen(path), 0);
+    bool dirty = false;
+
+    pthread_mutex_lock(&set->mutex);
+    path_node **link = find(set, path, hash);
+    if(*link != NULL && (*link)->dirty) {
+        (*link)->dirty = false;
+        dirty = true;
+    }
+    else if(*link != NULL)
+        unlink_node(set, link);
+    pthread_mutex_unlock(&set->mutex);
+    return dirty;
+}
+
+void path_set_remove(path_set *set, const char *path) {
+    uint64_t hash = hash_buffer(path, strlen(path), 0);
+
+    pthread_mutex_lock(&set->mutex);
+    path_node **link = find(set, path, hash);
+    if(*link != NULL)
+        unlink_node(set, link);
+    pthread_mutex_unlock(&set->mutex);
+}
+
+void path_set_destroy(path_set *set) {
+    for(size_t i = 0; i < set->n_buckets; i++) {
+        for(path_node *node = set->buckets[i], *next; node != NULL; node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    free(set->buckets);
+    pthread_mutex_destroy(&set->mutex);
+    free(set);
+}
@@ -0,0 +1,31 @@
+#ifndef PATH_SET_H_
+#define PATH_SET_H_
+
+#include <stdbool.h>
+
+/*
+ * Set of file paths, for the inputs that have a job queued or running in --watch mode. inotify can report a
+ * file more than once (a writer that closes it twice, a file that lands while the directory is scanned, a
+ * rescan after the event queue overflowed), and two jobs for one WAV would write the same MP3 at the same
+ * time. A path reported again while it is in the set is marked dirty instead, so its job can run once more
+ * when it finishes and pick up the final content. Paths are compared byte for byte. All functions are
+ * thread-safe.
+ */
+typedef struct path_set_t path_set;
+
+//! Create an empty set. Returns NULL on failure.
+path_set *path_set_create(void);
+
+//! Add path, setting *added, or mark it dirty if it is already in the set. Returns false if memory ran out.
+bool path_set_add(path_set *set, const char *path, bool *added);
+
+//! Remove path once its job is done, unless it was marked dirty meanwhile: then it stays in the set with the
+//! mark cleared, and true is returned so the caller runs the job again.
+bool path_set_finish(path_set *set, const char *path);
+
+//! Remove path, if it is in the set
+void path_set_remove(path_set *set, const char *path);
+
+void path_set_destroy(path_set *set);
+
+#endif /* PATH_SET_H_ */
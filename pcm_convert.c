@@ -0,0 +1,206 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "pcm_convert.h"
+#include "pcm_kernels.h"
+
+#if defined(PCM_X86)
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+static const pcm_kernels *kernels = &pcm_scalar_kernels;
+
+/*****************************************************************************************
+* Scalar kernels
+****************************************************************************************/
+static int32_t load_s16(const unsigned char *p) {
+    return (int32_t)(((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 24));
+}
+
+static int32_t load_s24(const unsigned char *p) {
+    return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+}
+
+static int32_t load_s32(const unsigned char *p) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+//! Round to the nearest 32-bit integer, saturating. NaN becomes the most negative value, as with the SIMD kernels.
+static int32_t saturate(float x) {
+    x = (x > PCM_FLOAT_MIN) ? x : PCM_FLOAT_MIN;
+    x = (x < PCM_FLOAT_MAX) ? x : PCM_FLOAT_MAX;
+    return (int32_t)lrintf(x);
+}
+
+static float load_f32(const unsigned char *p) {
+    float v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void scalar_split_s16(const unsigned char *in, int16_t *left, int16_t *right, int frames) {
+    for(int i = 0; i < frames; i++) {
+        memcpy(&left[i], &in[4 * i], sizeof(int16_t));
+        memcpy(&right[i], &in[4 * i + 2], sizeof(int16_t));
+    }
+}
+
+static void scalar_unpack_s16(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels) {
+    if(channels == 1) {
+        for(int i = 0; i < frames; i++)
+            left[i] = load_s16(&in[2 * i]);
+        return;
+    }
+    for(int i = 0; i < frames; i++) {
+        left[i] = load_s16(&in[4 * i]);
+        right[i] = load_s16(&in[4 * i + 2]);
+    }
+}
+
+static void scalar_unpack_s24(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels) {
+    if(channels == 1) {
+        for(int i = 0; i < frames; i++)
+            left[i] = load_s24(&in[3 * i]);
+        return;
+    }
+    for(int i = 0; i < frames; i++) {
+        left[i] = load_s24(&in[6 * i]);
+        right[i] = load_s24(&in[6 * i + 3]);
+    }
+}
+
+static void scalar_split_s32(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels) {
+    if(channels == 1) {
+        memcpy(left, in, (size_t)frames * sizeof(int32_t));
+        return;
+    }
+    for(int i = 0; i < frames; i++) {
+        left[i] = load_s32(&in[8 * i]);
+        right[i] = load_s32(&in[8 * i + 4]);
+    }
+}
+
+static void scalar_convert_f32(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels,
+                               float gain) {
+    float scale = gain * -PCM_FLOAT_MIN;
+
+    if(channels == 1) {
+        for(int i = 0; i < frames; i++)
+            left[i] = saturate(load_f32(&in[4 * i]) * scale);
+        return;
+    }
+    for(int i = 0; i < frames; i++) {
+        left[i] = saturate(load_f32(&in[8 * i]) * scale);
+        right[i] = saturate(load_f32(&in[8 * i + 4]) * scale);
+    }
+}
+
+static void scalar_gain_s32(int32_t *samples, int count, float gain) {
+    for(int i = 0; i < count; i++)
+        samples[i] = saturate((float)samples[i] * gain);
+}
+
+const pcm_kernels pcm_scalar_kernels = {
+    .name        = "scalar",
+    .split_s16   = scalar_split_s16,
+    .unpack_s16  = scalar_unpack_s16,
+    .unpack_s24  = scalar_unpack_s24,
+    .split_s32   = scalar_split_s32,
+    .convert_f32 = scalar_convert_f32,
+    .gain_s32    = scalar_gain_s32,
+};
+
+/*****************************************************************************************
+* Dispatch
+****************************************************************************************/
+#if defined(PCM_X86)
+static void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER)
+    __cpuidex((int *)regs, (int)leaf, (int)subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+//! State components the OS saves on context switches, only valid if CPUID reports OSXSAVE
+static unsigned long long xgetbv0(void) {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+//! The widest instruction set both the CPU and the OS support
+static const pcm_kernels *detect_kernels(void) {
+    unsigned regs[4];
+
+    cpuid(0, 0, regs);
+    unsigned max_leaf = regs[0];
+
+    cpuid(1, 0, regs);
+    bool sse2 = (regs[3] >> 26) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    if(!sse2)
+        return &pcm_scalar_kernels;
+    if(!osxsave || !avx || max_leaf < 7)
+        return &pcm_sse2_kernels;
+
+    unsigned long long xcr0 = xgetbv0();
+    if((xcr0 & 0x06) != 0x06) // XMM and YMM state
+        return &pcm_sse2_kernels;
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] >> 5) & 1;
+    bool avx512 = ((regs[1] >> 16) & 1) && ((regs[1] >> 30) & 1); // Foundation and byte/word instructions
+    if(avx512 && (xcr0 & 0xE0) == 0xE0) // Opmask and ZMM state
+        return &pcm_avx512_kernels;
+    return avx2 ? &pcm_avx2_kernels : &pcm_sse2_kernels;
+}
+#endif
+
+const char *pcm_init(void) {
+#if defined(PCM_X86)
+    kernels = detect_kernels();
+#endif
+    return kernels->name;
+}
+
+const char *pcm_kernel_name(void) {
+    return kernels->name;
+}
+
+void pcm_split_s16(const unsigned char *in, int16_t *left, int16_t *right, int frames) {
+    kernels->split_s16(in, left, right, frames);
+}
+
+void pcm_unpack_s16(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels) {
+    kernels->unpack_s16(in, left, right, frames, channels);
+}
+
+void pcm_unpack_s24(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels) {
+    kernels->unpack_s24(in, left, right, frames, channels);
+}
+
+void pcm_split_s32(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels) {
+    kernels->split_s32(in, left, right, frames, channels);
+}
+
+void pcm_convert_f32(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels, float gain) {
+    kernels->convert_f32(in, left, right, frames, channels, gain);
+}
+
+void pcm_gain_s32(int32_t *samples, int count, float gain) {
+    kernels->gain_s32(samples, count, gain);
+}
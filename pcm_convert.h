@@ -0,0 +1,43 @@
+#ifndef PCM_CONVERT_H_
+#define PCM_CONVERT_H_
+
+#include <stdint.h>
+
+/*
+ * Conversion of raw WAV sample data into the layouts LAME accepts. Stereo 16-bit samples are split into
+ * separate left and right buffers for lame_encode_buffer(). Everything else, including 16-bit samples
+ * that need a gain applied, goes to lame_encode_buffer_int() as separate buffers of 32-bit samples at
+ * full scale. Input is little endian and may be unaligned; the output buffers must hold frames samples
+ * each, and right is ignored for mono.
+ *
+ * Every conversion has scalar, SSE2, AVX2 and AVX-512 kernels. pcm_init() picks the best set the CPU
+ * supports, so a single binary runs at full speed on every generation of hardware.
+ */
+
+//! Pick the fastest kernels the CPU and OS support. Must be called before any worker threads are started.
+//! Returns the name of the instruction set chosen.
+const char *pcm_init(void);
+
+//! Name of the instruction set the kernels in use were written for
+const char *pcm_kernel_name(void);
+
+//! Split stereo 16-bit samples into left and right
+void pcm_split_s16(const unsigned char *in, int16_t *left, int16_t *right, int frames);
+
+//! Widen 16-bit samples to 32-bit samples at full scale, splitting stereo into left and right
+void pcm_unpack_s16(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels);
+
+//! Unpack packed 24-bit samples into 32-bit samples at full scale, splitting stereo into left and right
+void pcm_unpack_s24(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels);
+
+//! Split 32-bit samples into left and right, or copy them into left for mono
+void pcm_split_s32(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels);
+
+//! Convert float samples in [-1, 1] times gain to 32-bit samples at full scale, saturating, and split
+//! stereo into left and right
+void pcm_convert_f32(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels, float gain);
+
+//! Multiply 32-bit samples by gain in place, saturating
+void pcm_gain_s32(int32_t *samples, int count, float gain);
+
+#endif /* PCM_CONVERT_H_ */
@@ -0,0 +1,44 @@
+#ifndef PCM_KERNELS_H_
+#define PCM_KERNELS_H_
+
+#include <stdint.h>
+
+/*
+ * Internal to pcm_convert: one table of sample conversion kernels per instruction set, of which
+ * pcm_init() picks the best the CPU supports. See pcm_convert.h for what each kernel does. The SIMD
+ * kernels only handle whole vectors and finish the last few frames with the scalar ones.
+ */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define PCM_X86
+
+    #if defined(_MSC_VER)
+        #define PCM_TARGET(isa)
+    #else
+        #define PCM_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+// Float to int32 conversion saturates to this range; the upper bound is the largest float below 2^31
+#define PCM_FLOAT_MIN (-2147483648.0f)
+#define PCM_FLOAT_MAX (2147483520.0f)
+
+typedef struct pcm_kernels_t {
+    const char *name;
+    void (*split_s16)(const unsigned char *in, int16_t *left, int16_t *right, int frames);
+    void (*unpack_s16)(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels);
+    void (*unpack_s24)(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels);
+    void (*split_s32)(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels);
+    void (*convert_f32)(const unsigned char *in, int32_t *left, int32_t *right, int frames, int channels,
+                        float gain);
+    void (*gain_s32)(int32_t *samples, int count, float gain);
+} pcm_kernels;
+
+extern const pcm_kernels pcm_scalar_kernels;
+
+#if defined(PCM_X86)
+extern const pcm_kernels pcm_sse2_kernels;
+extern const pcm_kernels pcm_avx2_kernels;
+extern const pcm_kernels pcm_avx512_kernels;
+#endif
+
+#endif /* PCM_KERNELS_H_ */
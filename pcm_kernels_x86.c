@@ -0,0 +1,431 @@
+#include <stdint.h>
+
+#include "pcm_kernels.h"
+
+#if defined(PCM_X86)
+
+#include <immintrin.h>
+
+/*
+ * Each kernel is compiled for its instruction set with a target attribute, so the binary runs on any x86
+ * and pcm_init() only hands out the ones the CPU supports. Loads are unaligned, and the 24-bit kernels read
+ * a few bytes past the last sample they use, which the loop bounds account for.
+ */
+
+/*****************************************************************************************
+* SSE2
+****************************************************************************************/
+//! Four packed 24-bit samples from the first 12 of 16 bytes, each shifted into the top three bytes of its lane.
+//! SSE2 has no byte shuffle, so every lane is cut out of a differently shifted copy.
+PCM_TARGET("sse2") static inline __m128i sse2_unpack4_s24(const unsigned char *p) {
+    const __m128i lane0 = _mm_set_epi32(0, 0, 0, (int)0xFFFFFF00);
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+
+    return _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_slli_si128(x, 1), lane0),
+                                     _mm_and_si128(_mm_slli_si128(x, 2), _mm_slli_si128(lane0, 4))),
+                        _mm_or_si128(_mm_and_si128(_mm_slli_si128(x, 3), _mm_slli_si128(lane0, 8)),
+                                     _mm_and_si128(_mm_slli_si128(x, 4), _mm_slli_si128(lane0, 12))));
+}
+
+//! Split L0 R0 L1 R1 | L2 R2 L3 R3 into L0 L1 L2 L3 and R0 R1 R2 R3
+PCM_TARGET("sse2") static inline void sse2_split4(__m128i a, __m128i b, int32_t *left, int32_t *right) {
+    a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)left, _mm_unpacklo_epi64(a, b));
+    _mm_storeu_si128((__m128i *)right, _mm_unpackhi_epi64(a, b));
+}
+
+//! Round to 32-bit integers, saturating. MAXPS returns its second operand for NaN, so NaN saturates low.
+PCM_TARGET("sse2") static inline __m128i sse2_saturate(__m128 x) {
+    x = _mm_max_ps(x, _mm_set1_ps(PCM_FLOAT_MIN));
+    x = _mm_min_ps(x, _mm_set1_ps(PCM_FLOAT_MAX));
+    return _mm_cvtps_epi32(x);
+}
+
+PCM_TARGET("sse2") static void sse2_split_s16(const unsigned char *in, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+
+    for(; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&in[4 * i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&in[4 * i + 16]);
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                                    _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128((__m128i *)&left[i], l);
+        _mm_storeu_si128((__m128i *)&right[i], r);
+    }
+    pcm_scalar_kernels.split_s16(&in[4 * i], &left[i], &right[i], frames - i);
+}
+
+PCM_TARGET("sse2") static void sse2_unpack_s16(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                               int channels) {
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 8 <= frames; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i *)&in[2 * i]);
+            _mm_storeu_si128((__m128i *)&left[i], _mm_unpacklo_epi16(_mm_setzero_si128(), x));
+            _mm_storeu_si128((__m128i *)&left[i + 4], _mm_unpackhi_epi16(_mm_setzero_si128(), x));
+        }
+        pcm_scalar_kernels.unpack_s16(&in[2 * i], &left[i], right, frames - i, 1);
+        return;
+    }
+
+    for(; i + 4 <= frames; i += 4) { // Each 32-bit lane holds one frame, right channel on top
+        __m128i x = _mm_loadu_si128((const __m128i *)&in[4 * i]);
+        _mm_storeu_si128((__m128i *)&left[i], _mm_slli_epi32(x, 16));
+        _mm_storeu_si128((__m128i *)&right[i], _mm_and_si128(x, _mm_set1_epi32((int)0xFFFF0000)));
+    }
+    pcm_scalar_kernels.unpack_s16(&in[4 * i], &left[i], &right[i], frames - i, 2);
+}
+
+PCM_TARGET("sse2") static void sse2_unpack_s24(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                               int channels) {
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 6 <= frames; i += 4)
+            _mm_storeu_si128((__m128i *)&left[i], sse2_unpack4_s24(&in[3 * i]));
+        pcm_scalar_kernels.unpack_s24(&in[3 * i], &left[i], right, frames - i, 1);
+        return;
+    }
+
+    for(; i + 5 <= frames; i += 4)
+        sse2_split4(sse2_unpack4_s24(&in[6 * i]), sse2_unpack4_s24(&in[6 * i + 12]), &left[i], &right[i]);
+    pcm_scalar_kernels.unpack_s24(&in[6 * i], &left[i], &right[i], frames - i, 2);
+}
+
+PCM_TARGET("sse2") static void sse2_split_s32(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                              int channels) {
+    int i = 0;
+
+    if(channels == 2) {
+        for(; i + 4 <= frames; i += 4)
+            sse2_split4(_mm_loadu_si128((const __m128i *)&in[8 * i]), _mm_loadu_si128((const __m128i *)&in[8 * i + 16]),
+                        &left[i], &right[i]);
+    }
+    pcm_scalar_kernels.split_s32(&in[4 * channels * i], &left[i], (channels == 2) ? &right[i] : right,
+                                 frames - i, channels);
+}
+
+PCM_TARGET("sse2") static void sse2_convert_f32(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                                int channels, float gain) {
+    __m128 scale = _mm_set1_ps(gain * -PCM_FLOAT_MIN);
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 4 <= frames; i += 4) {
+            __m128 x = _mm_mul_ps(_mm_loadu_ps((const float *)&in[4 * i]), scale);
+            _mm_storeu_si128((__m128i *)&left[i], sse2_saturate(x));
+        }
+    }
+    else {
+        for(; i + 4 <= frames; i += 4) {
+            __m128 a = _mm_mul_ps(_mm_loadu_ps((const float *)&in[8 * i]), scale);
+            __m128 b = _mm_mul_ps(_mm_loadu_ps((const float *)&in[8 * i + 16]), scale);
+            sse2_split4(sse2_saturate(a), sse2_saturate(b), &left[i], &right[i]);
+        }
+    }
+    pcm_scalar_kernels.convert_f32(&in[4 * channels * i], &left[i], (channels == 2) ? &right[i] : right,
+                                   frames - i, channels, gain);
+}
+
+PCM_TARGET("sse2") static void sse2_gain_s32(int32_t *samples, int count, float gain) {
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)&samples[i]));
+        _mm_storeu_si128((__m128i *)&samples[i], sse2_saturate(_mm_mul_ps(x, g)));
+    }
+    pcm_scalar_kernels.gain_s32(&samples[i], count - i, gain);
+}
+
+const pcm_kernels pcm_sse2_kernels = {
+    .name        = "sse2",
+    .split_s16   = sse2_split_s16,
+    .unpack_s16  = sse2_unpack_s16,
+    .unpack_s24  = sse2_unpack_s24,
+    .split_s32   = sse2_split_s32,
+    .convert_f32 = sse2_convert_f32,
+    .gain_s32    = sse2_gain_s32,
+};
+
+/*****************************************************************************************
+* AVX2
+****************************************************************************************/
+//! Eight packed 24-bit samples from 24 of the 28 bytes at p, each shifted into the top three bytes of its lane
+PCM_TARGET("avx2") static inline __m256i avx2_unpack8_s24(const unsigned char *p) {
+    const __m256i shuffle = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                             -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                                        _mm_loadu_si128((const __m128i *)&p[12]), 1);
+    return _mm256_shuffle_epi8(x, shuffle);
+}
+
+//! Split two vectors of four interleaved frames each into eight left and eight right samples
+PCM_TARGET("avx2") static inline void avx2_split8(__m256i a, __m256i b, int32_t *left, int32_t *right) {
+    // L0 R0 L1 R1 | L2 R2 L3 R3 -> L0 L1 R0 R1 | L2 L3 R2 R3 -> L0 L1 L2 L3 | R0 R1 R2 R3
+    a = _mm256_permute4x64_epi64(_mm256_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm256_permute4x64_epi64(_mm256_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *)left, _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i *)right, _mm256_permute2x128_si256(a, b, 0x31));
+}
+
+PCM_TARGET("avx2") static inline __m256i avx2_saturate(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(PCM_FLOAT_MIN));
+    x = _mm256_min_ps(x, _mm256_set1_ps(PCM_FLOAT_MAX));
+    return _mm256_cvtps_epi32(x);
+}
+
+PCM_TARGET("avx2") static void avx2_split_s16(const unsigned char *in, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+
+    for(; i + 16 <= frames; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&in[4 * i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&in[4 * i + 32]);
+        __m256i l = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+                                       _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+        __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+        // Packing works within 128-bit lanes, so the halves of a and b come out interleaved
+        _mm256_storeu_si256((__m256i *)&left[i], _mm256_permute4x64_epi64(l, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_si256((__m256i *)&right[i], _mm256_permute4x64_epi64(r, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    pcm_scalar_kernels.split_s16(&in[4 * i], &left[i], &right[i], frames - i);
+}
+
+PCM_TARGET("avx2") static void avx2_unpack_s16(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                               int channels) {
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 16 <= frames; i += 16) {
+            __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&in[2 * i]));
+            __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&in[2 * i + 16]));
+            _mm256_storeu_si256((__m256i *)&left[i], _mm256_slli_epi32(lo, 16));
+            _mm256_storeu_si256((__m256i *)&left[i + 8], _mm256_slli_epi32(hi, 16));
+        }
+        pcm_scalar_kernels.unpack_s16(&in[2 * i], &left[i], right, frames - i, 1);
+        return;
+    }
+
+    for(; i + 8 <= frames; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)&in[4 * i]);
+        _mm256_storeu_si256((__m256i *)&left[i], _mm256_slli_epi32(x, 16));
+        _mm256_storeu_si256((__m256i *)&right[i], _mm256_and_si256(x, _mm256_set1_epi32((int)0xFFFF0000)));
+    }
+    pcm_scalar_kernels.unpack_s16(&in[4 * i], &left[i], &right[i], frames - i, 2);
+}
+
+PCM_TARGET("avx2") static void avx2_unpack_s24(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                               int channels) {
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 10 <= frames; i += 8)
+            _mm256_storeu_si256((__m256i *)&left[i], avx2_unpack8_s24(&in[3 * i]));
+        pcm_scalar_kernels.unpack_s24(&in[3 * i], &left[i], right, frames - i, 1);
+        return;
+    }
+
+    for(; i + 9 <= frames; i += 8)
+        avx2_split8(avx2_unpack8_s24(&in[6 * i]), avx2_unpack8_s24(&in[6 * i + 24]), &left[i], &right[i]);
+    pcm_scalar_kernels.unpack_s24(&in[6 * i], &left[i], &right[i], frames - i, 2);
+}
+
+PCM_TARGET("avx2") static void avx2_split_s32(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                              int channels) {
+    int i = 0;
+
+    if(channels == 2) {
+        for(; i + 8 <= frames; i += 8)
+            avx2_split8(_mm256_loadu_si256((const __m256i *)&in[8 * i]),
+                        _mm256_loadu_si256((const __m256i *)&in[8 * i + 32]), &left[i], &right[i]);
+    }
+    pcm_scalar_kernels.split_s32(&in[4 * channels * i], &left[i], (channels == 2) ? &right[i] : right,
+                                 frames - i, channels);
+}
+
+PCM_TARGET("avx2") static void avx2_convert_f32(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                                int channels, float gain) {
+    __m256 scale = _mm256_set1_ps(gain * -PCM_FLOAT_MIN);
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 8 <= frames; i += 8) {
+            __m256 x = _mm256_mul_ps(_mm256_loadu_ps((const float *)&in[4 * i]), scale);
+            _mm256_storeu_si256((__m256i *)&left[i], avx2_saturate(x));
+        }
+    }
+    else {
+        for(; i + 8 <= frames; i += 8) {
+            __m256 a = _mm256_mul_ps(_mm256_loadu_ps((const float *)&in[8 * i]), scale);
+            __m256 b = _mm256_mul_ps(_mm256_loadu_ps((const float *)&in[8 * i + 32]), scale);
+            avx2_split8(avx2_saturate(a), avx2_saturate(b), &left[i], &right[i]);
+        }
+    }
+    pcm_scalar_kernels.convert_f32(&in[4 * channels * i], &left[i], (channels == 2) ? &right[i] : right,
+                                   frames - i, channels, gain);
+}
+
+PCM_TARGET("avx2") static void avx2_gain_s32(int32_t *samples, int count, float gain) {
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+
+    for(; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)&samples[i]));
+        _mm256_storeu_si256((__m256i *)&samples[i], avx2_saturate(_mm256_mul_ps(x, g)));
+    }
+    pcm_scalar_kernels.gain_s32(&samples[i], count - i, gain);
+}
+
+const pcm_kernels pcm_avx2_kernels = {
+    .name        = "avx2",
+    .split_s16   = avx2_split_s16,
+    .unpack_s16  = avx2_unpack_s16,
+    .unpack_s24  = avx2_unpack_s24,
+    .split_s32   = avx2_split_s32,
+    .convert_f32 = avx2_convert_f32,
+    .gain_s32    = avx2_gain_s32,
+};
+
+/*****************************************************************************************
+* AVX-512 (foundation plus byte/word instructions)
+****************************************************************************************/
+#define AVX512 "avx512f,avx512bw"
+
+//! Sixteen packed 24-bit samples from 48 of the 64 bytes at p, each shifted into the top three bytes of its lane
+PCM_TARGET(AVX512) static inline __m512i avx512_unpack16_s24(const unsigned char *p) {
+    const __m512i gather = _mm512_set_epi32(12, 11, 10, 9, 9, 8, 7, 6, 6, 5, 4, 3, 3, 2, 1, 0);
+    const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+
+    // Give every 128-bit lane the 12 bytes it unpacks, then shuffle within lanes as with AVX2
+    __m512i x = _mm512_permutexvar_epi32(gather, _mm512_loadu_si512((const void *)p));
+    return _mm512_shuffle_epi8(x, shuffle);
+}
+
+//! Split two vectors of eight interleaved frames each into sixteen left and sixteen right samples
+PCM_TARGET(AVX512) static inline void avx512_split16(__m512i a, __m512i b, int32_t *left, int32_t *right) {
+    const __m512i even = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i odd = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+
+    _mm512_storeu_si512((void *)left, _mm512_permutex2var_epi32(a, even, b));
+    _mm512_storeu_si512((void *)right, _mm512_permutex2var_epi32(a, odd, b));
+}
+
+PCM_TARGET(AVX512) static inline __m512i avx512_saturate(__m512 x) {
+    x = _mm512_max_ps(x, _mm512_set1_ps(PCM_FLOAT_MIN));
+    x = _mm512_min_ps(x, _mm512_set1_ps(PCM_FLOAT_MAX));
+    return _mm512_cvtps_epi32(x);
+}
+
+PCM_TARGET(AVX512) static void avx512_split_s16(const unsigned char *in, int16_t *left, int16_t *right, int frames) {
+    const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    int i = 0;
+
+    for(; i + 32 <= frames; i += 32) {
+        __m512i a = _mm512_loadu_si512((const void *)&in[4 * i]);
+        __m512i b = _mm512_loadu_si512((const void *)&in[4 * i + 64]);
+        __m512i l = _mm512_packs_epi32(_mm512_srai_epi32(_mm512_slli_epi32(a, 16), 16),
+                                       _mm512_srai_epi32(_mm512_slli_epi32(b, 16), 16));
+        __m512i r = _mm512_packs_epi32(_mm512_srai_epi32(a, 16), _mm512_srai_epi32(b, 16));
+        _mm512_storeu_si512((void *)&left[i], _mm512_permutexvar_epi64(order, l));
+        _mm512_storeu_si512((void *)&right[i], _mm512_permutexvar_epi64(order, r));
+    }
+    pcm_scalar_kernels.split_s16(&in[4 * i], &left[i], &right[i], frames - i);
+}
+
+PCM_TARGET(AVX512) static void avx512_unpack_s16(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                                 int channels) {
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 16 <= frames; i += 16) {
+            __m512i x = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)&in[2 * i]));
+            _mm512_storeu_si512((void *)&left[i], _mm512_slli_epi32(x, 16));
+        }
+        pcm_scalar_kernels.unpack_s16(&in[2 * i], &left[i], right, frames - i, 1);
+        return;
+    }
+
+    for(; i + 16 <= frames; i += 16) {
+        __m512i x = _mm512_loadu_si512((const void *)&in[4 * i]);
+        _mm512_storeu_si512((void *)&left[i], _mm512_slli_epi32(x, 16));
+        _mm512_storeu_si512((void *)&right[i], _mm512_and_si512(x, _mm512_set1_epi32((int)0xFFFF0000)));
+    }
+    pcm_scalar_kernels.unpack_s16(&in[4 * i], &left[i], &right[i], frames - i, 2);
+}
+
+PCM_TARGET(AVX512) static void avx512_unpack_s24(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                                 int channels) {
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 22 <= frames; i += 16)
+            _mm512_storeu_si512((void *)&left[i], avx512_unpack16_s24(&in[3 * i]));
+        pcm_scalar_kernels.unpack_s24(&in[3 * i], &left[i], right, frames - i, 1);
+        return;
+    }
+
+    for(; i + 19 <= frames; i += 16)
+        avx512_split16(avx512_unpack16_s24(&in[6 * i]), avx512_unpack16_s24(&in[6 * i + 48]), &left[i], &right[i]);
+    pcm_scalar_kernels.unpack_s24(&in[6 * i], &left[i], &right[i], frames - i, 2);
+}
+
+PCM_TARGET(AVX512) static void avx512_split_s32(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                                int channels) {
+    int i = 0;
+
+    if(channels == 2) {
+        for(; i + 16 <= frames; i += 16)
+            avx512_split16(_mm512_loadu_si512((const void *)&in[8 * i]),
+                           _mm512_loadu_si512((const void *)&in[8 * i + 64]), &left[i], &right[i]);
+    }
+    pcm_scalar_kernels.split_s32(&in[4 * channels * i], &left[i], (channels == 2) ? &right[i] : right,
+                                 frames - i, channels);
+}
+
+PCM_TARGET(AVX512) static void avx512_convert_f32(const unsigned char *in, int32_t *left, int32_t *right, int frames,
+                                                  int channels, float gain) {
+    __m512 scale = _mm512_set1_ps(gain * -PCM_FLOAT_MIN);
+    int i = 0;
+
+    if(channels == 1) {
+        for(; i + 16 <= frames; i += 16) {
+            __m512 x = _mm512_mul_ps(_mm512_loadu_ps((const void *)&in[4 * i]), scale);
+            _mm512_storeu_si512((void *)&left[i], avx512_saturate(x));
+        }
+    }
+    else {
+        for(; i + 16 <= frames; i += 16) {
+            __m512 a = _mm512_mul_ps(_mm512_loadu_ps((const void *)&in[8 * i]), scale);
+            __m512 b = _mm512_mul_ps(_mm512_loadu_ps((const void *)&in[8 * i + 64]), scale);
+            avx512_split16(avx512_saturate(a), avx512_saturate(b), &left[i], &right[i]);
+        }
+    }
+    pcm_scalar_kernels.convert_f32(&in[4 * channels * i], &left[i], (channels == 2) ? &right[i] : right,
+                                   frames - i, channels, gain);
+}
+
+PCM_TARGET(AVX512) static void avx512_gain_s32(int32_t *samples, int count, float gain) {
+    __m512 g = _mm512_set1_ps(gain);
+    int i = 0;
+
+    for(; i + 16 <= count; i += 16) {
+        __m512 x = _mm512_cvtepi32_ps(_mm512_loadu_si512((const void *)&samples[i]));
+        _mm512_storeu_si512((void *)&samples[i], avx512_saturate(_mm512_mul_ps(x, g)));
+    }
+    pcm_scalar_kernels.gain_s32(&samples[i], count - i, gain);
+}
+
+const pcm_kernels pcm_avx512_kernels = {
+    .name        = "avx512",
+    .split_s16   = avx512_split_s16,
+    .unpack_s16  = avx512_unpack_s16,
+    .unpack_s24  = avx512_unpack_s24,
+    .split_s32   = avx512_split_s32,
+    .convert_f32 = avx512_convert_f32,
+    .gain_s32    = avx512_gain_s32,
+};
+
+#endif /* PCM_X86 */
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "perf_counters.h"
+
+#if defined(__linux__)
+    #include <errno.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+#endif
+
+bool perf_active;
+
+#if defined(__linux__)
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+enum perf_event_index { EVENT_CYCLES, EVENT_INSTRUCTIONS, EVENT_CACHE_MISSES, EVENT_BRANCH_MISSES, N_EVENTS };
+
+static const uint64_t event_configs[N_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                  PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+static const char *event_names[N_EVENTS] = { "cycles", "instructions", "cache misses", "branch misses" };
+
+//! Layout of a read() from a group leader with PERF_FORMAT_GROUP and both time fields
+typedef struct group_read_t {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[N_EVENTS];
+} group_read;
+
+typedef struct perf_totals_t {
+    double counts[N_EVENTS];
+    long long samples;
+    long long jobs;
+} perf_totals;
+
+typedef struct worker_counters_t {
+    int fds[N_EVENTS];               // -1 for events that couldn't be opened
+    int slot[N_EVENTS];              // Position of each event in a group read, -1 if not opened
+    bool opened;
+    group_read start;                // Counts when the current job started
+    perf_totals totals;
+} worker_counters;
+
+static worker_counters *workers;
+static int n_counted_workers;
+static THREAD_LOCAL worker_counters *current;
+
+static int open_event(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1; // Allowed up to perf_event_paranoid 2, the usual default
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC); // This thread, any CPU
+}
+
+//! Open the worker's counters on the calling thread, the cycles counter leading the group
+static void open_worker(worker_counters *w) {
+    int n = 0;
+    w->opened = true;
+    if((w->fds[EVENT_CYCLES] = open_event(event_configs[EVENT_CYCLES], -1)) < 0)
+        return; // Without a leader there is no group
+    for(int i = 0; i < N_EVENTS; i++) {
+        if(i != EVENT_CYCLES)
+            w->fds[i] = open_event(event_configs[i], w->fds[EVENT_CYCLES]);
+        if(w->fds[i] >= 0)
+            w->slot[i] = n++;
+    }
+}
+
+static bool read_group(const worker_counters *w, group_read *out) {
+    memset(out, 0, sizeof(group_read));
+    return w->fds[EVENT_CYCLES] >= 0 && read(w->fds[EVENT_CYCLES], out, sizeof(group_read)) > 0;
+}
+
+static void add_totals(perf_totals *sum, const perf_totals *t) {
+    for(int i = 0; i < N_EVENTS; i++)
+        sum->counts[i] += t->counts[i];
+    sum->samples += t->samples;
+    sum->jobs += t->jobs;
+}
+
+/*****************************************************************************************
+* Counting
+****************************************************************************************/
+bool perf_open(int n_workers) {
+    int fd = open_event(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(fd < 0) {
+        if(errno == EACCES || errno == EPERM)
+            printf("Hardware counters are not allowed (%s), see /proc/sys/kernel/perf_event_paranoid\n",
+                   strerror(errno));
+        else if(errno == ENOENT || errno == ENODEV || errno == EOPNOTSUPP) // No PMU, as in many virtual machines
+            puts("Hardware counters are not supported on this machine");
+        else
+            printf("Hardware counters are not available (%s)\n", strerror(errno));
+        return false;
+    }
+    close(fd);
+
+    if((workers = calloc(n_workers, sizeof(worker_counters))) == NULL)
+        return false;
+    n_counted_workers = n_workers;
+    for(int i = 0; i < n_workers; i++) {
+        for(int e = 0; e < N_EVENTS; e++)
+            workers[i].fds[e] = workers[i].slot[e] = -1;
+    }
+    perf_active = true;
+    return true;
+}
+
+void perf_job_begin(int worker_id) {
+    current = NULL;
+    if(worker_id < 0 || worker_id >= n_counted_workers)
+        return;
+    current = &workers[worker_id];
+    if(!current->opened) // Counters follow the thread that opened them, so this has to happen on the worker
+        open_worker(current);
+    read_group(current, &current->start);
+}
+
+void perf_job_end(const char *name, long long samples) {
+    worker_counters *w = current;
+    group_read end;
+    current = NULL;
+    if(w == NULL || !read_group(w, &end))
+        return;
+
+    // Scale up for the time the group wasn't scheduled on the PMU
+    uint64_t enabled = end.time_enabled - w->start.time_enabled;
+    uint64_t running = end.time_running - w->start.time_running;
+    double scale = (running > 0) ? (double)enabled / running : 0;
+
+    perf_totals job = { { 0 }, samples, 1 };
+    for(int i = 0; i < N_EVENTS; i++) {
+        if(w->slot[i] >= 0)
+            job.counts[i] = (double)(end.values[w->slot[i]] - w->start.values[w->slot[i]]) * scale;
+    }
+    add_totals(&w->totals, &job);
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "perf %.0f cycles, IPC ", job.counts[EVENT_CYCLES]);
+    if(w->slot[EVENT_INSTRUCTIONS] >= 0 && job.counts[EVENT_CYCLES] > 0)
+        len += snprintf(&line[len], sizeof(line) - len, "%.2f", job.counts[EVENT_INSTRUCTIONS] / job.counts[EVENT_CYCLES]);
+    else
+        len += snprintf(&line[len], sizeof(line) - len, "n/a");
+    for(int i = EVENT_CACHE_MISSES; i < N_EVENTS; i++) {
+        if(w->slot[i] < 0)
+            len += snprintf(&line[len], sizeof(line) - len, ", %s n/a", event_names[i]);
+        else if(samples > 0)
+            len += snprintf(&line[len], sizeof(line) - len, ", %s/sample %.4f", event_names[i], job.counts[i] / samples);
+        else
+            len += snprintf(&line[len], sizeof(line) - len, ", %s %.0f", event_names[i], job.counts[i]);
+    }
+    printf("%s %s\n", line, name); // One printf, so lines don't interleave
+}
+
+/*****************************************************************************************
+* Report
+****************************************************************************************/
+void perf_close(void) {
+    perf_totals sum;
+    bool supported[N_EVENTS] = { false }; // Opened on at least one worker
+    memset(&sum, 0, sizeof(sum));
+    for(int i = 0; i < n_counted_workers; i++) {
+        add_totals(&sum, &workers[i].totals);
+        for(int e = N_EVENTS - 1; e >= 0; e--) { // Siblings before their leader
+            if(workers[i].fds[e] >= 0) {
+                supported[e] = true;
+                close(workers[i].fds[e]);
+            }
+        }
+    }
+
+    if(sum.jobs > 0) {
+        printf("Hardware counters over %lld jobs, %lld samples:", sum.jobs, sum.samples);
+        if(supported[EVENT_INSTRUCTIONS] && sum.counts[EVENT_CYCLES] > 0)
+            printf(" IPC %.2f", sum.counts[EVENT_INSTRUCTIONS] / sum.counts[EVENT_CYCLES]);
+        printf("\n");
+        for(int i = 0; i < N_EVENTS; i++) {
+            if(!supported[i])
+                printf("  %-14s not supported\n", event_names[i]);
+            else if(sum.samples > 0)
+                printf("  %-14s %16.0f, %10.4f per sample\n", event_names[i], sum.counts[i], sum.counts[i] / sum.samples);
+            else
+                printf("  %-14s %16.0f\n", event_names[i], sum.counts[i]);
+        }
+    }
+
+    free(workers);
+    workers = NULL;
+    n_counted_workers = 0;
+    perf_active = false;
+}
+
+#else
+
+/*****************************************************************************************
+* Other platforms
+****************************************************************************************/
+bool perf_open(int n_workers) {
+    puts("Hardware counters are only supported on Linux");
+    return false;
+}
+
+void perf_job_begin(int worker_id) {
+}
+
+void perf_job_end(const char *name, long long samples) {
+}
+
+void perf_close(void) {
+}
+
+#endif
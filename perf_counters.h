@@ -0,0 +1,35 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdbool.h>
+
+/*
+ * Hardware performance counters per job (--perf, Linux only). Each worker opens a group of per-thread
+ * counters for cycles, instructions, cache misses and branch misses through perf_event_open() before its
+ * first job, and reads them when every job starts and ends. Jobs print their IPC and misses per sample
+ * frame, and the totals are summarized at exit. Counters are user space only, so the default
+ * perf_event_paranoid setting allows them.
+ *
+ * If the kernel refuses the counters, perf_open() says why and fails, and the run goes on without them. If
+ * it accepts only some of them, the missing ones are reported as n/a. Counts are scaled up when the kernel
+ * multiplexes the counters. Each worker keeps its own totals, found through a thread-local pointer.
+ */
+
+//! Whether counters are being collected. Only changed by perf_open() and perf_close().
+extern bool perf_active;
+
+//! Check that counters can be opened and set up per-worker state for n_workers workers. Returns false,
+//! after printing the reason, if they can't. Call before any worker thread starts.
+bool perf_open(int n_workers);
+
+//! Start counting a job on the calling thread, which is worker worker_id
+void perf_job_begin(int worker_id);
+
+//! Stop counting the calling thread's job and print its counts, labelled with name. samples is the number of
+//! sample frames it encoded, 0 if none.
+void perf_job_end(const char *name, long long samples);
+
+//! Print the totals of all jobs, close the counters and stop collecting. Call once no other thread is running.
+void perf_close(void);
+
+#endif /* PERF_COUNTERS_H_ */
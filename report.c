@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "filesystem_access.h"
+#include "json.h"
+#include "report.h"
+
+bool report_active;
+
+static FILE *report_file;
+static bool csv;
+static pthread_mutex_t report_mutex;
+
+static const char *format_name(uint16_t format_type) {
+    switch(format_type) {
+        case WAVE_FORMAT_PCM:        return "pcm";
+        case WAVE_FORMAT_IEEE_FLOAT: return "float";
+        case 6:                      return "alaw";
+        case 7:                      return "mulaw";
+        default:                     return "other";
+    }
+}
+
+/*****************************************************************************************
+* Field output
+****************************************************************************************/
+static void write_string(const char *s) {
+    if(s == NULL) {
+        fputs(csv ? "" : "null", report_file);
+        return;
+    }
+    if(csv) { // Quoted only when it has to be, doubling any quotes
+        if(strpbrk(s, ",\"\r\n") == NULL) {
+            fputs(s, report_file);
+            return;
+        }
+        fputc('"', report_file);
+        for(; *s != '\0'; s++) {
+            if(*s == '"')
+                fputc('"', report_file);
+            fputc(*s, report_file);
+        }
+        fputc('"', report_file);
+        return;
+    }
+
+    json_write_string(report_file, s);
+}
+
+//! Start a field: its name in JSON, a separator in CSV
+static void field(const char *name, bool first) {
+    if(csv)
+        fputs(first ? "" : ",", report_file);
+    else
+        fprintf(report_file, "%s\"%s\":", first ? "{" : ",", name);
+}
+
+static void write_integer(const char *name, long long value, bool known) {
+    field(name, false);
+    if(known)
+        fprintf(report_file, "%lld", value);
+    else
+        fputs(csv ? "" : "null", report_file);
+}
+
+static void write_decimal(const char *name, double value, bool known) {
+    field(name, false);
+    if(known)
+        fprintf(report_file, "%.6f", value);
+    else
+        fputs(csv ? "" : "null", report_file);
+}
+
+/*****************************************************************************************
+* Report
+****************************************************************************************/
+bool report_open(const char *path) {
+    if((report_file = fopen(path, "w")) == NULL) {
+        printf("Cannot write report %s\n", path);
+        return false;
+    }
+    size_t len = strlen(path);
+    csv = (len >= 4 && (strcmp(&path[len - 4], ".csv") == 0 || strcmp(&path[len - 4], ".CSV") == 0));
+    if(csv)
+        fputs("input,output,format,sample_rate,channels,bits_per_sample,duration_s,input_bytes,output_bytes,"
+              "wall_s,rtf,status,error\n", report_file);
+    pthread_mutex_init(&report_mutex, NULL);
+    report_active = true;
+    return true;
+}
+
+void report_job_start(job_report *job) {
+    job->start_ns = monotonic_ns();
+}
+
+void report_job(const char *in_path, const char *out_path, const job_report *job, double audio_seconds,
+                long long in_bytes, bool ok) {
+    double wall = (monotonic_ns() - job->start_ns) / 1e9;
+    long long out_bytes = ok ? f_size(out_path) : -1; // Stat outside the lock
+    const char *status = !ok ? "failed" : job->cached ? "cached" : "ok";
+    const char *error = ok ? NULL : (job->error != NULL) ? job->error : "encoding failed";
+    bool timed = job->parsed && audio_seconds > 0;
+
+    pthread_mutex_lock(&report_mutex);
+    field("input", true);
+    write_string(in_path);
+    field("output", false);
+    write_string(out_path);
+    field("format", false);
+    write_string(job->parsed ? format_name(job->format_type) : NULL);
+    write_integer("sample_rate", job->sample_rate, job->parsed);
+    write_integer("channels", job->n_channels, job->parsed);
+    write_integer("bits_per_sample", job->bits_per_sample, job->parsed);
+    write_decimal("duration_s", audio_seconds, job->parsed);
+    write_integer("input_bytes", in_bytes, in_bytes >= 0);
+    write_integer("output_bytes", out_bytes, out_bytes >= 0);
+    write_decimal("wall_s", wall, true);
+    write_decimal("rtf", timed ? wall / audio_seconds : 0, timed);
+    field("status", false);
+    write_string(status);
+    field("error", false);
+    write_string(error);
+    fputs(csv ? "\n" : "}\n", report_file);
+    fflush(report_file);
+    pthread_mutex_unlock(&report_mutex);
+}
+
+void report_close(void) {
+    if(fclose(report_file) != 0)
+        puts("Could not write the report");
+    report_file = NULL;
+    report_active = false;
+    pthread_mutex_destroy(&report_mutex);
+}
@@ -0,0 +1,46 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Machine-readable results of a run (--report=FILE), one record per input file: its paths, PCM format and
+ * duration, input and output sizes, encoding wall time, real-time factor and outcome. Files whose name ends
+ * in .csv get CSV with a header row, anything else JSON Lines. Records are written whole under a mutex, in
+ * the order jobs finish, and flushed as they go, so the file can be followed while a batch runs.
+ *
+ * The wall time of a job runs from when a worker picks it up until its MP3 is closed, across all segments
+ * of a split file. The real-time factor is the wall time over the audio duration, so below 1 is faster than
+ * real time.
+ */
+
+//! What a job has learnt about itself by the time it finishes, kept with the job's arguments
+typedef struct job_report_t {
+    long long start_ns;              // monotonic_ns() when the job started
+    bool      parsed;                // Whether the format fields below are set
+    uint16_t  format_type;
+    uint16_t  n_channels;
+    uint16_t  bits_per_sample;
+    uint32_t  sample_rate;
+    bool      cached;                // The MP3 came from the encode cache
+    const char *error;               // Static description of why the job failed, NULL if it didn't say
+} job_report;
+
+//! Whether a report is being written. Only changed by report_open() and report_close().
+extern bool report_active;
+
+//! Start writing a report to path. Call before any worker thread starts.
+bool report_open(const char *path);
+
+//! Note that job has started, for its wall time
+void report_job_start(job_report *job);
+
+//! Write the record of a finished job. ok is the job's outcome; in_bytes is -1 if unknown. Thread safe.
+void report_job(const char *in_path, const char *out_path, const job_report *job, double audio_seconds,
+                long long in_bytes, bool ok);
+
+//! Close the report. Call once no jobs are running.
+void report_close(void);
+
+#endif /* REPORT_H_ */
@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <lame/lame.h>
+
+#include "system_shims.h"
+#include "encoder.h"
+#include "worker_buffers.h"
+#include "split_encode.h"
+#include "trace.h"
+#include "perf_counters.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define WARMUP_FRAMES    (8) // Frames encoded ahead of a segment boundary and then discarded
+#define LOOKAHEAD_FRAMES (2) // Frames encoded past a segment boundary so the last kept frame sees real audio
+
+typedef struct segment_t {
+    long long first_frame;   // Index in the stitched stream of the first frame this segment keeps
+    long long n_frames;      // Number of frames to keep, or -1 to keep everything up to EOF
+
+    unsigned char *mp3;      // Kept frames, valid once done is set
+    size_t mp3_len;
+    size_t audio_offset;     // Bytes at the start of mp3 that belong to the tag frame (segment 0 only)
+    bool done;
+} segment;
+
+typedef struct split_ctx_t {
+    char *in_path;
+    worker_buffers *buffers;
+    wav_header fmt;
+    long long data_start;
+    long long n_samples;     // Samples per channel in the data region, 64 bits as long is 32 on Windows
+    int  quality;
+    float gain;
+    int  frame_size;
+    split_done done;
+
+    pthread_mutex_t mutex;   // Guards everything below
+    FILE *out;
+    int  n_segments;
+    int  committed;          // Segments before this index have been written to out
+    segment *segments;
+    bool failed;
+
+    long long total_frames;  // Audio frames written so far, excluding the tag frame
+    long long total_bytes;   // Bytes written so far, including the tag frame
+    long long *frame_offsets; // Byte offset of every audio frame, for the seek table
+    long long offsets_cap;
+    uint16_t music_crc;
+
+    unsigned char *tag;      // Tag frame LAME produced for segment 0
+    size_t tag_len;
+    long long seg0_frames;   // Stream totals the segment 0 tag frame was computed from
+    long long seg0_bytes;
+} split_ctx;
+
+typedef struct segment_args_t {
+    split_ctx *ctx;
+    int index;
+} segment_args;
+
+/*****************************************************************************************
+* MP3 bitstream helpers
+****************************************************************************************/
+//! Length in bytes of the Layer III frame starting at h, or 0 if h is not a valid frame header
+static size_t frame_length(const unsigned char *h, size_t avail) {
+    static const int bitrates_v1[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+    static const int bitrates_v2[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+    static const int samplerates[4] = {44100, 48000, 32000, 0};
+
+    if(avail < 4 || h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+        return 0;
+
+    int version  = (h[1] >> 3) & 3; // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+    int layer    = (h[1] >> 1) & 3; // 1 = Layer III
+    int br_index = h[2] >> 4;
+    int sr_index = (h[2] >> 2) & 3;
+    int padding  = (h[2] >> 1) & 1;
+
+    if(version == 1 || layer != 1 || samplerates[sr_index] == 0 || bitrates_v1[br_index] == 0)
+        return 0;
+
+    int rate = samplerates[sr_index] >> ((version == 3) ? 0 : (version == 2) ? 1 : 2);
+    if(version == 3)
+        return 144000 * bitrates_v1[br_index] / rate + padding;
+    else
+        return 72000 * bitrates_v2[br_index] / rate + padding;
+}
+
+//! Offset of the "Xing"/"Info" header inside a tag frame, or 0 if the frame doesn't carry one
+static size_t xing_offset(const unsigned char *frame, size_t len) {
+    static const size_t offsets[] = {4 + 32, 4 + 17, 4 + 9}; // Frame header plus the possible side info sizes
+
+    for(size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        if(offsets[i] + 8 <= len && (memcmp(&frame[offsets[i]], "Xing", 4) == 0 ||
+                                     memcmp(&frame[offsets[i]], "Info", 4) == 0))
+            return offsets[i];
+    }
+    return 0;
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+//! CRC-16 as used by the LAME tag (polynomial 0x8005, reflected, zero initial value)
+static uint16_t crc16_update(uint16_t crc, const unsigned char *data, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+    return crc;
+}
+
+/*! Rewrite the segment 0 tag frame so it describes the stitched stream. Totals are adjusted by the
+ *  difference to what segment 0 reported, which keeps LAME's own counting conventions intact.
+ */
+static void patch_tag(split_ctx *ctx) {
+    unsigned char *tag = ctx->tag;
+    size_t pos = xing_offset(tag, ctx->tag_len);
+    if(pos == 0)
+        return;
+
+    uint32_t flags = get_be32(&tag[pos + 4]);
+    pos += 8;
+
+    if(flags & 0x1) { // Frame count
+        put_be32(&tag[pos], get_be32(&tag[pos]) + (uint32_t)(ctx->total_frames - ctx->seg0_frames));
+        pos += 4;
+    }
+    if(flags & 0x2) { // Stream size
+        put_be32(&tag[pos], get_be32(&tag[pos]) + (uint32_t)(ctx->total_bytes - ctx->seg0_bytes));
+        pos += 4;
+    }
+    if(flags & 0x4) { // Seek table
+        for(int i = 0; i < 100; i++) {
+            long long frame = (long long)((double)i * ctx->total_frames / 100);
+            long point = (long)(256.0 * ctx->frame_offsets[frame] / ctx->total_bytes);
+            tag[pos + i] = (unsigned char)MIN(point, 255);
+        }
+        pos += 100;
+    }
+    if(flags & 0x8) // VBR quality
+        pos += 4;
+
+    if(pos + 36 > ctx->tag_len || memcmp(&tag[pos], "LAME", 4) != 0)
+        return;
+
+    int delay = (tag[pos + 21] << 4) | (tag[pos + 22] >> 4);
+    long long padding = ctx->total_frames * ctx->frame_size - delay - ctx->n_samples;
+    if(padding >= 0 && padding < 4096) {
+        tag[pos + 22] = (unsigned char)((tag[pos + 22] & 0xF0) | (padding >> 8));
+        tag[pos + 23] = (unsigned char)(padding & 0xFF);
+    }
+
+    put_be32(&tag[pos + 28], get_be32(&tag[pos + 28]) + (uint32_t)(ctx->total_bytes - ctx->seg0_bytes));
+    tag[pos + 32] = ctx->music_crc >> 8;
+    tag[pos + 33] = ctx->music_crc & 0xFF;
+
+    uint16_t tag_crc = crc16_update(0, tag, pos + 34);
+    tag[pos + 34] = tag_crc >> 8;
+    tag[pos + 35] = tag_crc & 0xFF;
+}
+
+/*****************************************************************************************
+* Segment jobs
+****************************************************************************************/
+//! Append a finished segment to the output, recording frame offsets and the music CRC. Called with the mutex held.
+static void commit_segment(split_ctx *ctx, segment *seg) {
+    size_t pos = seg->audio_offset;
+    size_t len;
+
+    while((len = frame_length(&seg->mp3[pos], seg->mp3_len - pos)) != 0 && pos + len <= seg->mp3_len) {
+        if(ctx->total_frames == ctx->offsets_cap) {
+            long long cap = MAX(1024, 2 * ctx->offsets_cap);
+            long long *tmp = realloc(ctx->frame_offsets, cap * sizeof(long long));
+            if(tmp == NULL) {
+                ctx->failed = true;
+                break;
+            }
+            ctx->frame_offsets = tmp;
+            ctx->offsets_cap = cap;
+        }
+        ctx->frame_offsets[ctx->total_frames++] = ctx->total_bytes + (long long)pos;
+        pos += len;
+    }
+
+    ctx->music_crc = crc16_update(ctx->music_crc, &seg->mp3[seg->audio_offset], seg->mp3_len - seg->audio_offset);
+    if(fwrite(seg->mp3, 1, seg->mp3_len, ctx->out) != seg->mp3_len)
+        ctx->failed = true;
+    ctx->total_bytes += (long long)seg->mp3_len;
+
+    free(seg->mp3);
+    seg->mp3 = NULL;
+}
+
+//! Write the tag, close the output and release the context once every segment has been committed
+static void finish_split(split_ctx *ctx) {
+    if(!ctx->failed && ctx->tag != NULL && ctx->total_frames > 0 &&
+       ctx->segments[0].audio_offset == ctx->tag_len) {
+        stage_begin(STAGE_TAG);
+        patch_tag(ctx);
+        fseek(ctx->out, 0, SEEK_SET);
+        fwrite(ctx->tag, 1, ctx->tag_len, ctx->out);
+        stage_end();
+    }
+
+    bool ok = (fclose(ctx->out) == 0 && !ctx->failed);
+    if(!ok)
+        printf("Failed to encode %s in segments\n", ctx->in_path);
+    ctx->done.func(ctx->done.args, ok);
+
+    pthread_mutex_destroy(&ctx->mutex);
+    free(ctx->frame_offsets);
+    free(ctx->segments);
+    free(ctx->tag);
+    free(ctx->in_path);
+    free(ctx);
+}
+
+//! First and one past the last sample a segment encodes, warmup and lookahead included
+static void segment_span(const split_ctx *ctx, int index, long long *start, long long *end) {
+    const segment *seg = &ctx->segments[index];
+    long long warmup = (index == 0) ? 0 : WARMUP_FRAMES;
+
+    *start = (seg->first_frame - warmup) * ctx->frame_size;
+    *end = (index == ctx->n_segments - 1) ? ctx->n_samples
+         : MIN(ctx->n_samples, (seg->first_frame + seg->n_frames + LOOKAHEAD_FRAMES) * ctx->frame_size);
+}
+
+/*! Encode one segment into memory, trim it to the frames it owns, then commit every finished segment that is
+ *  next in line. Whichever segment commits the last one finalizes the file, after which ctx is gone. Runs
+ *  inside whatever job calls it, without any job bookkeeping of its own.
+ */
+static void run_segment(split_ctx *ctx, int index, int worker_id) {
+    segment *seg = &ctx->segments[index];
+    bool first = (index == 0);
+    bool last = (index == ctx->n_segments - 1);
+    long long warmup = first ? 0 : WARMUP_FRAMES;
+    long long start, end;
+    segment_span(ctx, index, &start, &end);
+
+    int block_align = ctx->fmt.block_align;
+    buffer_arena *arena = worker_arena(ctx->buffers, worker_id, PCM_SIZE, block_align);
+    int32_t *scratch = worker_scratch(ctx->buffers, worker_id);
+    unsigned char *pcm_buffer = (arena != NULL) ? arena->pcm : NULL;
+    size_t cap = 4 * MP3_BUFFER_BOUND(PCM_SIZE), len = 0;
+    unsigned char *mp3 = malloc(cap);
+    stage_begin(STAGE_OPEN);
+    FILE *pcm = fopen(ctx->in_path, "rb");
+    stage_end();
+    lame_t lame = init_encoder(&ctx->fmt, ctx->quality, ENCODER_SEGMENT | (first ? 0 : ENCODER_NO_TAG));
+    bool failed = (pcm_buffer == NULL || scratch == NULL || mp3 == NULL || pcm == NULL || lame == NULL);
+
+    if(!failed && f_seek(pcm, ctx->data_start + start * block_align, SEEK_SET) != 0)
+        failed = true;
+
+    for(long long remaining = end - start; !failed; ) {
+        if(cap - len < MP3_BUFFER_BOUND(PCM_SIZE)) {
+            unsigned char *tmp = realloc(mp3, 2 * cap);
+            if(tmp == NULL) {
+                failed = true;
+                break;
+            }
+            mp3 = tmp;
+            cap *= 2;
+        }
+
+        stage_begin(STAGE_READ);
+        int read = (int)fread(pcm_buffer, block_align, (size_t)MIN(PCM_SIZE, remaining), pcm);
+        int write;
+        remaining -= read;
+        stage_end();
+
+        stage_begin((read == 0) ? STAGE_FLUSH : STAGE_ENCODE);
+        if(read == 0)
+            write = lame_encode_flush(lame, &mp3[len], (int)(cap - len));
+        else
+            write = encode_frames(lame, &ctx->fmt, pcm_buffer, read, ctx->gain, scratch, &mp3[len],
+                                  (int)(cap - len));
+        stage_end();
+
+        if(write < 0)
+            failed = true;
+        else
+            len += write;
+
+        if(read == 0)
+            break;
+    }
+
+    // Locate the frames this segment owns: skip the tag frame and warmup, stop at the next segment's first frame
+    size_t pos = 0, keep_from = 0, keep_to = len, frame;
+    long long n_frames = 0;
+    unsigned char *tag = NULL;
+    size_t tag_len = 0;
+
+    if(!failed && first && (frame = frame_length(mp3, len)) != 0 && xing_offset(mp3, frame) != 0) {
+        pos = frame;
+        tag_len = lame_get_lametag_frame(lame, NULL, 0);
+        tag = malloc(tag_len);
+        if(tag == NULL || lame_get_lametag_frame(lame, tag, tag_len) != tag_len) {
+            free(tag);
+            tag = NULL;
+        }
+    }
+    size_t audio_offset = pos;
+
+    while(!failed && pos < len) {
+        frame = frame_length(&mp3[pos], len - pos);
+        if(frame == 0 || pos + frame > len) {
+            failed = true;
+            break;
+        }
+        if(!first && n_frames == warmup)
+            keep_from = pos;
+        if(!last && n_frames == warmup + seg->n_frames && keep_to == len)
+            keep_to = pos;
+        n_frames++;
+        pos += frame;
+    }
+
+    if(!failed && (keep_to <= keep_from || (!last && keep_to == len)))
+        failed = true; // Segment produced fewer frames than it owns
+
+    size_t full_len = len;
+    if(!failed) {
+        memmove(mp3, &mp3[keep_from], keep_to - keep_from);
+        len = keep_to - keep_from;
+    }
+
+    if(lame != NULL)
+        lame_close(lame);
+    if(pcm != NULL)
+        fclose(pcm);
+
+    pthread_mutex_lock(&ctx->mutex);
+    seg->mp3 = mp3;
+    seg->mp3_len = failed ? 0 : len;
+    seg->audio_offset = (first && !failed) ? audio_offset : 0;
+    seg->done = true;
+    ctx->failed |= failed;
+    if(first) {
+        ctx->tag = tag;
+        ctx->tag_len = tag_len;
+        ctx->seg0_frames = n_frames;
+        ctx->seg0_bytes = (long long)full_len;
+    }
+
+    stage_begin(STAGE_WRITE);
+    while(ctx->committed < ctx->n_segments && ctx->segments[ctx->committed].done)
+        commit_segment(ctx, &ctx->segments[ctx->committed++]);
+    bool finished = (ctx->committed == ctx->n_segments);
+    pthread_mutex_unlock(&ctx->mutex);
+    stage_end();
+
+    if(finished)
+        finish_split(ctx);
+}
+
+//! Pool job running one segment as a job of its own
+static void encode_segment(void *arg, int worker_id) {
+    segment_args args = *(segment_args *)arg;
+    free(arg);
+    char name[INITIAL_SYS_PATH_LEN + 32]; // Taken now: once another job finishes the file, ctx is gone
+    long long start, end;
+    snprintf(name, sizeof(name), "%s segment %d", args.ctx->in_path, args.index);
+    segment_span(args.ctx, args.index, &start, &end);
+
+    stage_job_begin(worker_id, args.ctx->in_path);
+    if(perf_active)
+        perf_job_begin(worker_id);
+    run_segment(args.ctx, args.index, worker_id);
+    stage_job_end(name);
+    if(perf_active)
+        perf_job_end(name, end - start);
+}
+
+/*****************************************************************************************
+* Setup
+****************************************************************************************/
+bool split_encode(thread_pool *pool, worker_buffers *buffers, filepath in_file, filepath out_file,
+                  const wav_header *fmt, int quality, float gain, int segment_seconds, split_done done,
+                  int worker_id) {
+    if(segment_seconds <= 0 || fmt->sample_rate == 0 || fmt->n_channels == 0)
+        return false;
+
+    long long file_size = f_size(in_file.path);
+    if(file_size < fmt->data_offset)
+        return false;
+    long long data_len = MIN(file_size - fmt->data_offset, (long long)fmt->data_len);
+    long long n_samples = data_len / fmt->block_align;
+
+    lame_t probe = init_encoder(fmt, quality, 0);
+    if(probe == NULL)
+        return false;
+    int frame_size = lame_get_framesize(probe);
+    lame_close(probe);
+
+    long long segment_frames = MAX((long long)segment_seconds * fmt->sample_rate / frame_size, 2 * WARMUP_FRAMES);
+    int n_segments = (int)(n_samples / frame_size / segment_frames); // The last segment absorbs the remainder
+    if(n_segments < 2)
+        return false;
+
+    split_ctx *ctx = calloc(1, sizeof(split_ctx));
+    segment_args **args = calloc(n_segments, sizeof(segment_args *));
+    if(ctx == NULL || args == NULL) {
+        free(ctx);
+        free(args);
+        return false;
+    }
+
+    ctx->segments = calloc(n_segments, sizeof(segment));
+    ctx->in_path = malloc(in_file.path_len + 1);
+    remove(out_file.path); // It may be hard linked to a cache entry, which must not be overwritten
+    ctx->out = fopen(out_file.path, "wb+");
+    bool ok = (ctx->segments != NULL && ctx->in_path != NULL && ctx->out != NULL);
+
+    for(int i = 0; ok && i < n_segments; i++) {
+        args[i] = malloc(sizeof(segment_args)); // This will be freed by the segment job
+        ok = (args[i] != NULL);
+    }
+
+    if(!ok) {
+        for(int i = 0; i < n_segments; i++)
+            free(args[i]);
+        free(args);
+        if(ctx->out != NULL)
+            fclose(ctx->out);
+        free(ctx->segments);
+        free(ctx->in_path);
+        free(ctx);
+        return false;
+    }
+
+    memcpy(ctx->in_path, in_file.path, in_file.path_len + 1);
+    ctx->buffers = buffers;
+    ctx->fmt = *fmt;
+    ctx->data_start = fmt->data_offset;
+    ctx->n_samples = n_samples;
+    ctx->quality = quality;
+    ctx->gain = gain;
+    ctx->frame_size = frame_size;
+    ctx->done = done;
+    ctx->n_segments = n_segments;
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    for(int i = 0; i < n_segments; i++) {
+        ctx->segments[i].first_frame = (long long)i * segment_frames;
+        ctx->segments[i].n_frames = (i == n_segments - 1) ? -1 : segment_frames;
+    }
+
+    for(int i = 0; i < n_segments; i++) {
+        args[i]->ctx = ctx;
+        args[i]->index = i;
+        if(!pool_submit(pool, encode_segment, args[i], POOL_PRIORITY_MAX)) { // Finish files already in progress first
+            free(args[i]);
+            run_segment(ctx, i, worker_id); // Couldn't queue it, so do the work within the calling job instead
+        }
+    }
+    free(args);
+
+    return true;
+}
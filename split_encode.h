@@ -0,0 +1,34 @@
+#ifndef SPLIT_ENCODE_H_
+#define SPLIT_ENCODE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "filesystem_access.h"
+#include "thread_pool.h"
+#include "worker_buffers.h"
+
+/*
+ * Intra-file parallelism for very long WAVs. The PCM data is cut into time segments that are encoded on
+ * separate LAME instances by the worker pool, each starting a few frames early so the filterbank and
+ * psychoacoustic model are warmed up by the time the kept frames begin. The bit reservoir is disabled so
+ * every frame is self-contained and segments can be stitched at any frame boundary. The Xing/LAME tag of
+ * the first segment is patched to describe the whole stream once the last segment has been written.
+ */
+
+//! Called once the output file of a split job is complete, with whether it was written successfully
+typedef struct split_done_t {
+    void (*func)(void *args, bool ok);
+    void *args;
+} split_done;
+
+//! Queue the segments of in_file's PCM data, as located by parse_wav, on the pool. Each segment uses the
+//! scratch and buffer arena of the worker it runs on. Returns false without queueing anything if the file is
+//! shorter than two segments or setup failed, in which case the caller should encode it normally. On
+//! success the segment jobs take care of writing out_file and call done once it is closed. worker_id is the
+//! pool worker calling this, which encodes any segment that cannot be queued itself.
+bool split_encode(thread_pool *pool, worker_buffers *buffers, filepath in_file, filepath out_file,
+                  const wav_header *fmt, int quality, float gain, int segment_seconds, split_done done,
+                  int worker_id);
+
+#endif /* SPLIT_ENCODE_H_ */
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include "stage_timing.h"
+
+#if defined(STAGE_TIMING)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "system_shims.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define MAX_DEPTH (8)  // Deepest nesting of stages
+#define BUCKETS   (40) // Histogram bucket b counts durations below 2^b ns; the last one takes everything longer
+
+static const char *stage_names[STAGE_COUNT] = STAGE_NAMES;
+
+typedef struct stage_stats_t {
+    long long total_ns;
+    long long calls;
+    long long buckets[BUCKETS];
+} stage_stats;
+
+typedef struct worker_timing_t {
+    stage_stats stages[STAGE_COUNT];
+    long long jobs;
+    long long job_ns;                // Wall time of all jobs, stages included
+} worker_timing;
+
+typedef struct frame_t {
+    enum timing_stage stage;
+    long long own_ns;                // Time in this stage so far, excluding nested stages
+} frame;
+
+//! State of the job running on this thread
+typedef struct job_timing_t {
+    worker_timing *worker;           // NULL outside jobs
+    long long start_ns;
+    long long last_ns;               // When time was last charged to a stage
+    long long stage_ns[STAGE_COUNT];
+    frame stack[MAX_DEPTH];
+    int depth;
+} job_timing;
+
+static worker_timing *workers;
+static int n_timed_workers;
+static THREAD_LOCAL job_timing current;
+
+static int bucket_of(long long ns) {
+    int b = 0;
+    while(b < BUCKETS - 1 && ns >= (1LL << b))
+        b++;
+    return b;
+}
+
+//! Charge the time since the last switch to the innermost stage
+static long long charge(void) {
+    long long now = monotonic_ns();
+    if(current.depth > 0)
+        current.stack[current.depth - 1].own_ns += now - current.last_ns;
+    current.last_ns = now;
+    return now;
+}
+
+/*****************************************************************************************
+* Recording
+****************************************************************************************/
+void timing_init(int n_workers) {
+    workers = calloc(n_workers, sizeof(worker_timing));
+    n_timed_workers = (workers != NULL) ? n_workers : 0;
+}
+
+void timing_job_begin(int worker_id) {
+    memset(&current, 0, sizeof(job_timing));
+    if(worker_id < 0 || worker_id >= n_timed_workers)
+        return;
+    current.worker = &workers[worker_id];
+    current.start_ns = current.last_ns = monotonic_ns();
+}
+
+void timing_push(enum timing_stage stage) {
+    if(current.worker == NULL || current.depth == MAX_DEPTH)
+        return;
+    charge();
+    current.stack[current.depth++] = (frame) { stage, 0 };
+}
+
+void timing_pop(void) {
+    if(current.worker == NULL || current.depth == 0)
+        return;
+    charge();
+
+    frame f = current.stack[--current.depth];
+    stage_stats *stats = &current.worker->stages[f.stage];
+    stats->total_ns += f.own_ns;
+    stats->calls++;
+    stats->buckets[bucket_of(f.own_ns)]++;
+    current.stage_ns[f.stage] += f.own_ns;
+}
+
+void timing_job_end(const char *name) {
+    if(current.worker == NULL)
+        return;
+    while(current.depth > 0) // A stage left early on an error path
+        timing_pop();
+
+    long long wall = monotonic_ns() - current.start_ns, staged = 0;
+    char line[256];
+    int len = snprintf(line, sizeof(line), "timing %.3f ms:", wall / 1e6);
+    for(int s = 0; s < STAGE_COUNT; s++) {
+        staged += current.stage_ns[s];
+        len += snprintf(&line[len], sizeof(line) - len, " %s %.3f", stage_names[s], current.stage_ns[s] / 1e6);
+    }
+    printf("%s other %.3f %s\n", line, (wall - staged) / 1e6, name); // One printf, so lines don't interleave
+
+    current.worker->jobs++;
+    current.worker->job_ns += wall;
+    current.worker = NULL;
+}
+
+/*****************************************************************************************
+* Report
+****************************************************************************************/
+static void print_row(const char *label, const worker_timing *w) {
+    long long staged = 0;
+    printf("  %-10s %8lld", label, w->jobs);
+    for(int s = 0; s < STAGE_COUNT; s++) {
+        printf(" %10.1f", w->stages[s].total_ns / 1e6);
+        staged += w->stages[s].total_ns;
+    }
+    printf(" %10.1f %10.1f\n", (w->job_ns - staged) / 1e6, w->job_ns / 1e6);
+}
+
+//! Upper bound of the bucket the given fraction of calls falls in
+static long long percentile(const stage_stats *stats, double fraction) {
+    long long seen = 0;
+    for(int b = 0; b < BUCKETS; b++) {
+        seen += stats->buckets[b];
+        if(seen >= fraction * stats->calls)
+            return 1LL << b;
+    }
+    return 1LL << (BUCKETS - 1);
+}
+
+static void print_duration(long long ns) {
+    if(ns < 1000)
+        printf("%6lld ns", ns);
+    else if(ns < 1000000)
+        printf("%6lld us", ns / 1000);
+    else if(ns < 1000000000)
+        printf("%6lld ms", ns / 1000000);
+    else
+        printf("%6lld s ", ns / 1000000000);
+}
+
+void timing_report(void) {
+    worker_timing sum;
+    memset(&sum, 0, sizeof(sum));
+
+    printf("Stage timing in ms:\n  %-10s %8s", "worker", "jobs");
+    for(int s = 0; s < STAGE_COUNT; s++)
+        printf(" %10s", stage_names[s]);
+    printf(" %10s %10s\n", "other", "wall");
+
+    for(int i = 0; i < n_timed_workers; i++) {
+        worker_timing *w = &workers[i];
+        char label[16];
+        snprintf(label, sizeof(label), "%d", i);
+        if(w->jobs > 0)
+            print_row(label, w);
+
+        sum.jobs += w->jobs;
+        sum.job_ns += w->job_ns;
+        for(int s = 0; s < STAGE_COUNT; s++) {
+            sum.stages[s].total_ns += w->stages[s].total_ns;
+            sum.stages[s].calls += w->stages[s].calls;
+            for(int b = 0; b < BUCKETS; b++)
+                sum.stages[s].buckets[b] += w->stages[s].buckets[b];
+        }
+    }
+    print_row("total", &sum);
+
+    for(int s = 0; s < STAGE_COUNT; s++) {
+        const stage_stats *stats = &sum.stages[s];
+        if(stats->calls == 0)
+            continue;
+        printf("Stage %s: %lld calls, mean %.1f us, p50 <", stage_names[s], stats->calls,
+               stats->total_ns / 1e3 / stats->calls);
+        print_duration(percentile(stats, 0.5));
+        printf(", p99 <");
+        print_duration(percentile(stats, 0.99));
+        printf("\n");
+
+        long long peak = 0;
+        for(int b = 0; b < BUCKETS; b++)
+            peak = MAX(peak, stats->buckets[b]);
+        for(int b = 0; b < BUCKETS; b++) {
+            if(stats->buckets[b] == 0)
+                continue;
+            printf("    <");
+            if(b == BUCKETS - 1)
+                printf("   inf   ");
+            else
+                print_duration(1LL << b);
+            printf(" %10lld ", stats->buckets[b]);
+            for(long long bar = (40 * stats->buckets[b] + peak - 1) / peak; bar > 0; bar--)
+                putchar('#');
+            putchar('\n');
+        }
+    }
+
+    free(workers);
+    workers = NULL;
+    n_timed_workers = 0;
+}
+
+#endif
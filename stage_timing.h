@@ -0,0 +1,60 @@
+#ifndef STAGE_TIMING_H_
+#define STAGE_TIMING_H_
+
+/*
+ * Where the time of each job goes, measured with the monotonic clock around every stage of the encoding
+ * loop. Only built with -DSTAGE_TIMING (make TIMING=1); otherwise every call below compiles to nothing.
+ *
+ * Each worker keeps its own totals and histograms, reached through a thread-local pointer set when a job
+ * starts, so nothing is shared between workers while they run. Stages nest: time spent waiting on the I/O
+ * pipeline inside a read is charged to the wait and not to the read, so the stages of a job add up to at
+ * most its wall time. Whatever is left over (hashing, cache lookups, queueing segments) is reported as
+ * "other". A line is printed for every job as it finishes, and the per-worker totals and a log2 latency
+ * histogram of every stage at the end of the run.
+ */
+enum timing_stage {
+    STAGE_OPEN,     // Opening the input and output files
+    STAGE_PARSE,    // Reading and checking the WAV header
+    STAGE_READ,     // Getting the next block of PCM data
+    STAGE_ENCODE,   // LAME encoding a block
+    STAGE_FLUSH,    // LAME flushing the last frames
+    STAGE_WRITE,    // Handing MP3 data to the writer, and closing it
+    STAGE_TAG,      // Writing the VBR tag
+    STAGE_WAIT,     // Blocked on the I/O pipeline
+    STAGE_COUNT
+};
+
+#define STAGE_NAMES { "open", "parse", "read", "encode", "flush", "write", "tag", "wait" }
+
+#if defined(STAGE_TIMING)
+
+//! Set up counters for n_workers workers. Call before the pool starts.
+void timing_init(int n_workers);
+
+//! Start timing a job on the calling thread, which is worker worker_id
+void timing_job_begin(int worker_id);
+
+//! Finish the job on the calling thread and print its stages, labelled with name
+void timing_job_end(const char *name);
+
+//! Enter stage on the calling thread. Every push is matched by a pop.
+void timing_push(enum timing_stage stage);
+
+//! Leave the stage entered last
+void timing_pop(void);
+
+//! Print the per-worker totals and the stage histograms and free the counters. Call once no jobs are running.
+void timing_report(void);
+
+#else
+
+#define timing_init(n_workers)       ((void)0)
+#define timing_job_begin(worker_id)  ((void)0)
+#define timing_job_end(name)         ((void)0)
+#define timing_push(stage)           ((void)0)
+#define timing_pop()                 ((void)0)
+#define timing_report()              ((void)0)
+
+#endif
+
+#endif /* STAGE_TIMING_H_ */
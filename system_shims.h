@@ -11,6 +11,7 @@
     #include <windows.h>
     #include <direct.h> 
     #include <io.h>
+    #include <sys/stat.h>
     #define getCwd _getcwd
 
     enum access_modes {
@@ -20,9 +21,26 @@
     };
 
     #define f_access(file, mode) _access((file), (mode))
+    #define make_dir(path)       _mkdir((path))
+    #define make_link(from, to)  (CreateHardLinkA((to), (from), NULL) ? 0 : -1)
+    #define f_seek(file, offset, origin) _fseeki64((file), (long long)(offset), (origin)) // long is 32 bits here
+
+    //! Size of a file in bytes, or -1 if it cannot be queried
+    static inline long long f_size(const char *file) {
+        struct _stat64 st;
+        return (_stat64(file, &st) == 0) ? (long long)st.st_size : -1;
+    }
 
     #define INITIAL_SYS_PATH_LEN MAX_PATH
 
+    //! Nanoseconds on a clock that never goes back, for measuring intervals
+    static inline long long monotonic_ns(void) {
+        LARGE_INTEGER now, freq;
+        QueryPerformanceCounter(&now);
+        QueryPerformanceFrequency(&freq);
+        return (long long)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+    }
+
 /*
  * pthreads shim API
  */
@@ -42,12 +60,15 @@
     #define pthread_cond_destroy(cv)     
 
     #define pthread_cond_signal(cv)         WakeConditionVariable((cv))
+    #define pthread_cond_broadcast(cv)      WakeAllConditionVariable((cv))
     #define pthread_cond_wait(cv, mutex)    SleepConditionVariableCS((cv), (mutex), INFINITE)
 
-    #define pthread_create(tid, attr, f, arg) *tid = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)f, arg, 0, NULL)
+    #define pthread_create(tid, attr, f, arg) \
+        ((*(tid) = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)f, arg, 0, NULL)) != NULL ? 0 : -1)
+    #define pthread_join(tid, ret)            (WaitForSingleObject((tid), INFINITE), CloseHandle((tid)))
 
 
-    int getNumCPUs(void) {
+    static inline int getNumCPUs(void) {
         SYSTEM_INFO sysinfo;
         GetSystemInfo(&sysinfo); // This call can only count up to 32 cores
                                  // GetNativeSystemInfo would count up to 64 if available, but adds call complexity
@@ -60,7 +81,9 @@
 #else /* Hope this is reasonably posix-compliant compiler. If not, good luck */
     #include <pthread.h>
     #include <unistd.h>
+    #include <sys/stat.h>
     #include <limits.h> /* Let's hope this includes PATH_MAX and NAME_MAX, but it probably doesn't on most systems */
+    #include <time.h>
 
     #define getCwd getcwd
 
@@ -71,7 +94,25 @@
     };
 
     #define f_access(file, mode) access((file), (mode))
-    
+    #define make_dir(path)       mkdir((path), 0777)
+    #define make_link(from, to)  link((from), (to))
+    #define f_seek(file, offset, origin) fseeko((file), (off_t)(offset), (origin)) // Needs _GNU_SOURCE
+
+    //! Size of a file in bytes, or -1 if it cannot be queried
+    static inline long long f_size(const char *file) {
+        struct stat st;
+        return (stat(file, &st) == 0) ? (long long)st.st_size : -1;
+    }
+
+    //! Nanoseconds on a clock that never goes back, for measuring intervals. clock_gettime() is POSIX rather
+    //! than C99, so this only exists in files that define _GNU_SOURCE before any include.
+    #if defined(CLOCK_MONOTONIC)
+    static inline long long monotonic_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    #endif
 
     #if defined(PATH_MAX)
         #define INITIAL_SYS_PATH_LEN PATH_MAX
@@ -79,7 +120,7 @@
         #define INITIAL_SYS_PATH_LEN 255
     #endif
 
-    int getNumCPUs(void) {
+    static inline int getNumCPUs(void) {
         return sysconf(_SC_NPROCESSORS_ONLN);
     }
 
@@ -87,6 +128,31 @@
 
 #endif
 
+/*****************************************************************************************
+ * Atomics. C99 has no <stdatomic.h>, so these map onto compiler intrinsics and are only used on longs.
+ ****************************************************************************************/
+#if defined(_MSC_VER)
+    /* MSVC gives volatile accesses acquire/release semantics on x86 */
+    #define atomic_load_acquire(ptr)     (*(volatile long *)(ptr))
+    #define atomic_store_release(ptr, v) (*(volatile long *)(ptr) = (v))
+    #define atomic_fetch_add(ptr, v)     InterlockedExchangeAdd((volatile long *)(ptr), (v))
+    #define atomic_fence()               MemoryBarrier()
+#else
+    #define atomic_load_acquire(ptr)     __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define atomic_store_release(ptr, v) __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+    #define atomic_fetch_add(ptr, v)     __atomic_fetch_add((ptr), (v), __ATOMIC_SEQ_CST)
+    #define atomic_fence()               __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/*****************************************************************************************
+ * Thread-local storage, which C99 doesn't have either
+ ****************************************************************************************/
+#if defined(_MSC_VER)
+    #define THREAD_LOCAL __declspec(thread)
+#else
+    #define THREAD_LOCAL __thread
+#endif
+
 /*****************************************************************************************
  * Defines that really should be in the standard library
  ****************************************************************************************/
@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+typedef struct job_t {
+    job_func func;
+    void *args;
+    long long priority;
+    unsigned long long seq;     // Submission order, to keep equal priorities first-in first-out
+} job;
+
+struct thread_pool_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond_var;   // Signalled when a job is queued or the pool may shut down
+
+    job *queue;                 // Binary max-heap ordered by job_before()
+    size_t queued;
+    size_t capacity;
+    unsigned long long next_seq;
+
+    int  running;               // Jobs currently executing on a worker
+    int  active;                // Most jobs allowed to execute at once, at most n_workers
+    bool shutdown;
+
+    int n_workers;
+    pthread_t *workers;
+    worker_hook init;
+};
+
+typedef struct worker_args_t {
+    thread_pool *pool;
+    int id;
+} worker_args;
+
+/*****************************************************************************************
+* Job queue
+****************************************************************************************/
+static bool job_before(const job *a, const job *b) {
+    if(a->priority != b->priority)
+        return a->priority > b->priority;
+    return a->seq < b->seq;
+}
+
+static void heap_push(thread_pool *pool, job j) {
+    size_t i = pool->queued++;
+
+    while(i > 0 && job_before(&j, &pool->queue[(i - 1) / 2])) {
+        pool->queue[i] = pool->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    pool->queue[i] = j;
+}
+
+static job heap_pop(thread_pool *pool) {
+    job top = pool->queue[0];
+    job last = pool->queue[--pool->queued];
+    size_t i = 0;
+
+    while(2 * i + 1 < pool->queued) {
+        size_t child = 2 * i + 1;
+        if(child + 1 < pool->queued && job_before(&pool->queue[child + 1], &pool->queue[child]))
+            child++;
+        if(!job_before(&pool->queue[child], &last))
+            break;
+        pool->queue[i] = pool->queue[child];
+        i = child;
+    }
+    pool->queue[i] = last;
+
+    return top;
+}
+
+/*****************************************************************************************
+* Workers
+****************************************************************************************/
+/*! Workers only exit once shutdown is requested *and* nothing is running, since a running job may still
+ *  submit follow-up work to the queue. Workers beyond the active limit wait even while jobs are queued.
+ */
+static void *worker_main(void *arg) {
+    worker_args w = *(worker_args *)arg;
+    thread_pool *pool = w.pool;
+    free(arg);
+
+    if(pool->init.func != NULL)
+        pool->init.func(w.id, pool->init.args);
+
+    pthread_mutex_lock(&pool->mutex);
+    while(1) {
+        while((pool->queued == 0 || pool->running >= pool->active) && !(pool->shutdown && pool->running == 0))
+            pthread_cond_wait(&pool->cond_var, &pool->mutex);
+
+        if(pool->queued == 0) // Shutting down with nothing left to do
+            break;
+
+        job j = heap_pop(pool);
+        pool->running++;
+        if(trace_active) {
+            trace_counter("queue depth", (long)pool->queued);
+            trace_counter("jobs in flight", pool->running);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        j.func(j.args, w.id);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        if(trace_active)
+            trace_counter("jobs in flight", pool->running);
+        if(pool->running == 0 && pool->queued == 0) // Wake pool_drain() and pool_join()
+            pthread_cond_broadcast(&pool->cond_var);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+thread_pool *pool_create(int n_workers, worker_hook init) {
+    thread_pool *pool = calloc(1, sizeof(thread_pool));
+    if(pool == NULL)
+        return NULL;
+
+    pool->workers = calloc(n_workers, sizeof(pthread_t));
+    if(pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->init = init;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond_var, NULL);
+
+    for(int i = 0; i < n_workers; i++) {
+        worker_args *w = malloc(sizeof(worker_args)); // This will be freed by the worker
+        if(w == NULL)
+            break;
+        w->pool = pool;
+        w->id = i;
+
+        if(pthread_create(&pool->workers[i], NULL, worker_main, w) != 0) { // Run with the workers started so far
+            free(w);
+            break;
+        }
+        pool->n_workers++;
+    }
+
+    if(pool->n_workers == 0) {
+        pool_join(pool);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->active = pool->n_workers;
+    pthread_cond_broadcast(&pool->cond_var);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return pool;
+}
+
+bool pool_submit(thread_pool *pool, job_func func, void *args, long long priority) {
+    bool queued = true;
+
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->queued == pool->capacity) {
+        size_t capacity = MAX(64, 2 * pool->capacity);
+        job *tmp = realloc(pool->queue, capacity * sizeof(job));
+        if(tmp != NULL) {
+            pool->queue = tmp;
+            pool->capacity = capacity;
+        }
+        else
+            queued = false;
+    }
+
+    if(queued) {
+        heap_push(pool, (job) { func, args, priority, pool->next_seq++ });
+        if(trace_active)
+            trace_counter("queue depth", (long)pool->queued);
+        pthread_cond_signal(&pool->cond_var);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return queued;
+}
+
+int pool_set_active(thread_pool *pool, int n_active) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->active = MIN(MAX(n_active, 1), pool->n_workers);
+    n_active = pool->active;
+    if(trace_active)
+        trace_counter("active limit", n_active);
+    pthread_cond_broadcast(&pool->cond_var); // Idle workers may now be allowed to take queued jobs
+    pthread_mutex_unlock(&pool->mutex);
+
+    return n_active;
+}
+
+void pool_drain(thread_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->queued > 0 || pool->running > 0)
+        pthread_cond_wait(&pool->cond_var, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_join(thread_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->cond_var);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(int i = 0; i < pool->n_workers; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond_var);
+
+    free(pool->queue);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <stdbool.h>
+#include <limits.h>
+
+/*
+ * Fixed-size pool of long-lived worker threads pulling jobs from a shared priority queue. Jobs with a higher
+ * priority run first; jobs of equal priority run in submission order. The number of jobs running at once
+ * can be lowered below the number of workers while the pool runs.
+ */
+typedef void(*job_func)(void *args, int worker_id);
+
+#define POOL_PRIORITY_DEFAULT (0)
+#define POOL_PRIORITY_MAX     (LLONG_MAX)
+
+typedef struct thread_pool_t thread_pool;
+
+//! Run by every worker thread when it starts, before it takes any job
+typedef struct worker_hook_t {
+    void (*func)(int worker_id, void *args);
+    void *args;
+} worker_hook;
+
+//! Spawn n_workers threads that idle until jobs are submitted. init.func may be NULL. If some threads can't be
+//! created the pool runs with the ones that were. Returns NULL if none were.
+thread_pool *pool_create(int n_workers, worker_hook init);
+
+//! Queue a job for the next free worker. Safe to call from inside a running job.
+//! Returns false if the job could not be queued.
+bool pool_submit(thread_pool *pool, job_func func, void *args, long long priority);
+
+//! Let at most n_active jobs run at once, clamped to 1..n_workers. Running jobs are never interrupted; if the
+//! limit drops, workers stop taking jobs until enough of them finish. Returns the limit in effect.
+int pool_set_active(thread_pool *pool, int n_active);
+
+//! Block until the queue is drained and no job is running, leaving the workers waiting for more jobs
+void pool_drain(thread_pool *pool);
+
+//! Block until the queue is drained and no job is running, then join the workers and free the pool
+void pool_join(thread_pool *pool);
+
+#endif /* THREAD_POOL_H_ */
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "json.h"
+#include "trace.h"
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define CHUNK_EVENTS (4096) // Events per buffer chunk; buffers grow a chunk at a time and never move
+#define OTHER_TIDS   (1000) // Tracks of threads that aren't workers are numbered from here
+
+static const char *stage_names[STAGE_COUNT] = STAGE_NAMES;
+
+typedef struct event_t {
+    char phase;                      // 'B', 'E' or 'C', as in the Trace Event Format
+    const char *name;                // Static string
+    long long ts_ns;                 // Since the trace started
+    long value;                      // Counters only
+    char *file;                      // Job spans only, owned by the event
+} event;
+
+typedef struct chunk_t {
+    event events[CHUNK_EVENTS];
+    int used;
+    struct chunk_t *next;
+} chunk;
+
+typedef struct thread_buffer_t {
+    chunk *first;
+    chunk *last;
+    int tid;
+    char name[32];
+    struct thread_buffer_t *next;    // All buffers, for trace_close()
+} thread_buffer;
+
+bool trace_active;
+
+static FILE *trace_file;
+static long long start_ns;
+static pthread_mutex_t buffers_mutex; // Only taken when a thread records its first event
+static thread_buffer *buffers;
+static int next_tid = OTHER_TIDS;
+static THREAD_LOCAL thread_buffer *local;
+
+/*****************************************************************************************
+* Buffers
+****************************************************************************************/
+//! The calling thread's buffer, created on first use. NULL if memory ran out.
+static thread_buffer *thread_local_buffer(void) {
+    if(local != NULL)
+        return local;
+
+    thread_buffer *b = calloc(1, sizeof(thread_buffer));
+    if(b == NULL)
+        return NULL;
+    pthread_mutex_lock(&buffers_mutex);
+    b->tid = next_tid++;
+    snprintf(b->name, sizeof(b->name), "thread %d", b->tid - OTHER_TIDS);
+    b->next = buffers;
+    buffers = b;
+    pthread_mutex_unlock(&buffers_mutex);
+    return local = b;
+}
+
+static event *add_event(char phase, const char *name) {
+    thread_buffer *b = thread_local_buffer();
+    if(b == NULL)
+        return NULL;
+
+    if(b->last == NULL || b->last->used == CHUNK_EVENTS) {
+        chunk *c = malloc(sizeof(chunk));
+        if(c == NULL)
+            return NULL;
+        c->used = 0;
+        c->next = NULL;
+        if(b->last != NULL)
+            b->last->next = c;
+        else
+            b->first = c;
+        b->last = c;
+    }
+
+    event *e = &b->last->events[b->last->used++];
+    e->phase = phase;
+    e->name = name;
+    e->ts_ns = monotonic_ns() - start_ns;
+    e->value = 0;
+    e->file = NULL;
+    return e;
+}
+
+/*****************************************************************************************
+* Recording
+****************************************************************************************/
+bool trace_open(const char *path) {
+    if((trace_file = fopen(path, "wb")) == NULL) {
+        printf("Cannot write trace %s\n", path);
+        return false;
+    }
+    pthread_mutex_init(&buffers_mutex, NULL);
+    start_ns = monotonic_ns();
+    trace_active = true;
+    return true;
+}
+
+void trace_thread_name(const char *name) {
+    thread_buffer *b = thread_local_buffer();
+    if(b != NULL)
+        snprintf(b->name, sizeof(b->name), "%s", name);
+}
+
+void trace_job_begin(int worker_id, const char *file) {
+    thread_buffer *b = thread_local_buffer();
+    if(b != NULL && b->tid >= OTHER_TIDS) { // First job on this worker, give it the worker's track
+        b->tid = worker_id;
+        snprintf(b->name, sizeof(b->name), "worker %d", worker_id);
+    }
+
+    event *e = add_event('B', "job");
+    if(e != NULL)
+        e->file = strdup(file);
+}
+
+void trace_job_end(void) {
+    add_event('E', "job");
+}
+
+void trace_begin(enum timing_stage stage) {
+    add_event('B', stage_names[stage]);
+}
+
+void trace_end(void) {
+    add_event('E', NULL);
+}
+
+void trace_counter(const char *name, long value) {
+    event *e = add_event('C', name);
+    if(e != NULL)
+        e->value = value;
+}
+
+/*****************************************************************************************
+* Output
+****************************************************************************************/
+static void write_event(FILE *file, const thread_buffer *b, const event *e) {
+    fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", e->phase, b->tid, e->ts_ns / 1e3);
+    if(e->name != NULL) {
+        fprintf(file, ",\"name\":");
+        json_write_string(file, e->name);
+    }
+    if(e->phase == 'C')
+        fprintf(file, ",\"args\":{\"value\":%ld}", e->value);
+    else if(e->file != NULL) {
+        fprintf(file, ",\"args\":{\"file\":");
+        json_write_string(file, e->file);
+        fprintf(file, "}");
+    }
+    fprintf(file, "}");
+}
+
+void trace_close(void) {
+    FILE *file = trace_file;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"WavConverter\"}}");
+
+    for(thread_buffer *b = buffers, *next; b != NULL; b = next) {
+        fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":", b->tid);
+        json_write_string(file, b->name);
+        fprintf(file, "}},\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_sort_index\",\"args\":"
+                      "{\"sort_index\":%d}}", b->tid, b->tid);
+
+        for(chunk *c = b->first, *next_chunk; c != NULL; c = next_chunk) {
+            for(int i = 0; i < c->used; i++) {
+                write_event(file, b, &c->events[i]);
+                free(c->events[i].file);
+            }
+            next_chunk = c->next;
+            free(c);
+        }
+        next = b->next;
+        free(b);
+    }
+
+    fprintf(file, "\n]}\n");
+    if(fclose(file) != 0)
+        puts("Could not write the trace");
+
+    buffers = NULL;
+    local = NULL;
+    trace_file = NULL;
+    trace_active = false;
+    pthread_mutex_destroy(&buffers_mutex);
+}
@@ -0,0 +1,53 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+
+#include "stage_timing.h"
+
+/*
+ * Timeline trace of a run in the Trace Event Format, for chrome://tracing and ui.perfetto.dev (--trace).
+ * Every worker thread gets a track with a span for each job and, nested in it, for each stage of the job;
+ * blocks are encoded one span per chunk. Counter tracks follow the depth of the pool's queue and the number
+ * of jobs in flight.
+ *
+ * Each thread appends events to a buffer of its own, found through a thread-local pointer, so tracing
+ * takes no locks while the workers run. The buffers are only merged into the output file by trace_close().
+ */
+
+//! Whether a trace is being recorded. Only changed by trace_open() and trace_close().
+extern bool trace_active;
+
+//! Start recording a trace to be written to path. Call before any worker thread starts.
+bool trace_open(const char *path);
+
+//! Name the calling thread's track. Worker tracks are named when their first job starts.
+void trace_thread_name(const char *name);
+
+//! Start a job span on the calling thread, which is worker worker_id, with the input file as its argument
+void trace_job_begin(int worker_id, const char *file);
+
+void trace_job_end(void);
+
+//! Start a span for stage on the calling thread. Spans nest and must be ended in reverse order.
+void trace_begin(enum timing_stage stage);
+
+void trace_end(void);
+
+//! Record a new value for a counter track. name must be a string literal.
+void trace_counter(const char *name, long value);
+
+//! Merge every thread's events into the trace file and stop recording. Call once no other thread is running.
+void trace_close(void);
+
+/*****************************************************************************************
+* Stage hooks, feeding both the per-stage timing when it is built in and the trace when one is recorded
+****************************************************************************************/
+#define stage_begin(stage) do { timing_push(stage); if(trace_active) trace_begin(stage); } while(0)
+#define stage_end()        do { if(trace_active) trace_end(); timing_pop(); } while(0)
+
+#define stage_job_begin(worker_id, file) \
+    do { timing_job_begin(worker_id); if(trace_active) trace_job_begin((worker_id), (file)); } while(0)
+#define stage_job_end(name) do { if(trace_active) trace_job_end(); timing_job_end(name); } while(0)
+
+#endif /* TRACE_H_ */
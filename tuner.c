@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "tuner.h"
+#include "trace.h"
+
+#if !defined(_WIN32)
+    #include <time.h>
+#endif
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+#define TICK_MS       (250)   // How often the tuner wakes up to look at the counters
+#define WINDOW_MS     (2000)  // Shortest measurement window
+#define WINDOW_MAX_MS (60000) // Windows in which too few jobs finish are dropped after this long
+#define NOISE         (0.03)  // Throughput changes smaller than this fraction are treated as noise
+#define SETTLED_PROBE (3)     // Steady windows after which a neighbouring limit is tried again
+
+struct tuner_t {
+    thread_pool *pool;
+    int max_active;
+    pthread_t thread;
+    long stop;                       // Set atomically to end the thread
+
+    long audio_ms;                   // Audio of finished jobs, updated atomically. Only differences matter,
+    long jobs;                       // so wrapping around is harmless.
+
+    // Only touched by the tuner thread
+    int active;
+    int direction;                   // +1 or -1, the way the last move went
+    int steady;                      // Windows since the last move
+    double last_rate;                // Throughput of the previous window, negative before the first one
+    double best_rate;
+    int best_active;
+};
+
+static long long monotonic_ms(void) {
+    return monotonic_ns() / 1000000;
+}
+
+static void sleep_ms(int ms) {
+#if defined(_WIN32)
+    Sleep(ms);
+#else
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/*****************************************************************************************
+* Controller
+****************************************************************************************/
+//! Move the active limit one step in the current direction, turning around at the ends of the range
+static void move(tuner *t) {
+    int next = t->active + t->direction;
+    if(next < 1 || next > t->max_active) {
+        t->direction = -t->direction;
+        next = t->active + t->direction;
+    }
+    if(next < 1 || next > t->max_active) // A single worker, nothing to tune
+        return;
+
+    t->active = pool_set_active(t->pool, next);
+    t->steady = 0;
+}
+
+//! Decide on the next limit from the throughput of the window that just ended at the current one
+static void adjust(tuner *t, double rate) {
+    if(rate > t->best_rate) {
+        t->best_rate = rate;
+        t->best_active = t->active;
+    }
+
+    if(t->last_rate < 0) // Nothing to compare with yet, start exploring upwards
+        move(t);
+    else if(rate > t->last_rate * (1 + NOISE)) // The last move helped, keep going
+        move(t);
+    else if(rate < t->last_rate * (1 - NOISE)) { // It hurt, go back
+        t->direction = -t->direction;
+        move(t);
+    }
+    else if(++t->steady >= SETTLED_PROBE) // Settled, but the best value may have drifted since
+        move(t);
+    t->last_rate = rate;
+}
+
+/*! A window lasts at least WINDOW_MS and until as many jobs have finished as may run at once, so every
+ *  worker contributes to it even when single files take longer than a window.
+ */
+static void *tuner_main(void *arg) {
+    tuner *t = arg;
+    long long start = monotonic_ms();
+    long start_audio = atomic_load_acquire(&t->audio_ms);
+    long start_jobs = atomic_load_acquire(&t->jobs);
+    if(trace_active)
+        trace_thread_name("concurrency tuner");
+
+    while(!atomic_load_acquire(&t->stop)) {
+        sleep_ms(TICK_MS);
+
+        long long now = monotonic_ms();
+        long audio = atomic_load_acquire(&t->audio_ms);
+        long jobs = atomic_load_acquire(&t->jobs);
+        long long elapsed = now - start;
+        long done = (long)((unsigned long)jobs - (unsigned long)start_jobs);
+
+        if(elapsed < WINDOW_MS || (done < t->active && elapsed < WINDOW_MAX_MS))
+            continue;
+        if(done >= t->active) // Otherwise the input is starved and throughput says nothing about the limit
+            adjust(t, (double)(long)((unsigned long)audio - (unsigned long)start_audio) / (double)elapsed);
+
+        start = now;
+        start_audio = audio;
+        start_jobs = jobs;
+    }
+    return NULL;
+}
+
+/*****************************************************************************************
+* Tuner
+****************************************************************************************/
+tuner *tuner_create(thread_pool *pool, int start, int max_active) {
+    tuner *t = calloc(1, sizeof(tuner));
+    if(t == NULL)
+        return NULL;
+
+    t->pool = pool;
+    t->max_active = MAX(max_active, 1);
+    t->active = pool_set_active(pool, start);
+    t->direction = 1;
+    t->last_rate = -1;
+    t->best_active = t->active;
+
+    pthread_create(&t->thread, NULL, tuner_main, t);
+    return t;
+}
+
+void tuner_record(tuner *t, double audio_seconds) {
+    atomic_fetch_add(&t->audio_ms, (long)(audio_seconds * 1000));
+    atomic_fetch_add(&t->jobs, 1);
+}
+
+void tuner_destroy(tuner *t) {
+    atomic_store_release(&t->stop, 1);
+    pthread_join(t->thread, NULL);
+
+    if(t->best_rate > 0)
+        printf("Adaptive concurrency: %d jobs at once at the end, best was %d at %.1f audio seconds per second\n",
+               t->active, t->best_active, t->best_rate);
+    else
+        printf("Adaptive concurrency: %d jobs at once, batch too short to measure\n", t->active);
+    free(t);
+}
@@ -0,0 +1,26 @@
+#ifndef TUNER_H_
+#define TUNER_H_
+
+#include "thread_pool.h"
+
+/*
+ * Adaptive concurrency for --max-cores auto. The best number of jobs to run at once depends on where the
+ * input lives: CPU-bound batches on a local SSD want one per core, while batches read from a slow network
+ * mount keep more encoders busy if extra jobs are waiting on I/O. A background thread measures the batch's
+ * throughput in seconds of audio encoded per second of wall time over successive windows and hill-climbs
+ * the pool's active limit: it keeps moving in one direction while throughput improves, turns around when it
+ * drops, and probes a neighbouring value now and then once it has settled, in case conditions changed.
+ */
+typedef struct tuner_t tuner;
+
+//! Start tuning pool, whose active limit is set to start and then kept between 1 and max_active, which should
+//! be the number of workers in the pool. Returns NULL on failure, in which case the limit is left alone.
+tuner *tuner_create(thread_pool *pool, int start, int max_active);
+
+//! Count a finished job towards the throughput. Safe to call from any thread.
+void tuner_record(tuner *t, double audio_seconds);
+
+//! Stop tuning, print the limit it settled on and the best throughput seen, and free the tuner
+void tuner_destroy(tuner *t);
+
+#endif /* TUNER_H_ */
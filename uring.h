@@ -0,0 +1,65 @@
+#ifndef URING_H_
+#define URING_H_
+
+/*
+ * Minimal io_uring wrapper on top of the raw system calls, so the static build doesn't need liburing.
+ * Only available on Linux with kernel headers that know about io_uring; HAVE_IO_URING is defined if so.
+ */
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define HAVE_IO_URING
+    #endif
+#endif
+
+#if defined(HAVE_IO_URING)
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+typedef struct uring_t {
+    int fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;     // Entries prepared, including those not yet handed to the kernel
+    unsigned sq_submitted;      // Entries handed to the kernel
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_len;
+    size_t cq_ring_len;
+    size_t sqes_len;
+} uring;
+
+//! Create a ring with room for entries submissions. Returns false if the kernel doesn't support io_uring
+//! or doesn't let us use it.
+bool uring_init(uring *ring, unsigned entries);
+
+//! Tear down a ring created by uring_init
+void uring_exit(uring *ring);
+
+//! Next free submission entry, zeroed, or NULL if the submission queue is full
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+
+//! Hand every prepared entry to the kernel and wait for at least wait_nr completions
+int uring_submit(uring *ring, unsigned wait_nr);
+
+//! Oldest unprocessed completion, or NULL if there is none
+struct io_uring_cqe *uring_peek(uring *ring);
+
+//! Mark the completion returned by uring_peek as processed
+void uring_seen(uring *ring);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* URING_H_ */
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "system_shims.h"
+#include "watch.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+/*****************************************************************************************
+* Configuration defines
+****************************************************************************************/
+// IN_CREATE is only acted on for directories; files are picked up once they are complete
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+#define EVENT_BUFFER (64 * 1024)
+
+typedef struct watched_dir_t {
+    int wd;
+    filepath path;                   // With a trailing separator, starting with the watched root
+} watched_dir;
+
+typedef struct watcher_t {
+    int fd;
+    bool recursive;
+    char *extension;
+    callback cb;
+
+    watched_dir *dirs;
+    size_t count;
+    size_t capacity;
+} watcher;
+
+static int stop_pipe[2] = { -1, -1 }; // Written to by the signal handler, whichever thread it runs on
+
+static void request_stop(int sig) {
+    (void)sig;
+    char c = 0;
+    ssize_t ret = write(stop_pipe[1], &c, 1);
+    (void)ret;
+}
+
+static watched_dir *find_dir(watcher *w, int wd) {
+    for(size_t i = 0; i < w->count; i++) {
+        if(w->dirs[i].wd == wd)
+            return &w->dirs[i];
+    }
+    return NULL;
+}
+
+/*! Watch dir and, in recursive mode, every directory below it. With scan, files already in them are reported
+ *  too, for directories that appear while watching. Takes ownership of dir.path.
+ */
+static bool add_watch(watcher *w, filepath dir, bool scan) {
+    int wd = inotify_add_watch(w->fd, dir.path, WATCH_EVENTS);
+    if(wd < 0) {
+        printf("Cannot watch directory '%s': %s\n", dir.path, strerror(errno));
+        free(dir.path);
+        return false;
+    }
+
+    if(find_dir(w, wd) != NULL) { // Already watched, e.g. seen both on creation and in a scan of its parent
+        free(dir.path);
+        return true;
+    }
+
+    if(w->count == w->capacity) {
+        size_t capacity = MAX(64, 2 * w->capacity);
+        watched_dir *tmp = realloc(w->dirs, capacity * sizeof(watched_dir));
+        if(tmp == NULL) {
+            inotify_rm_watch(w->fd, wd);
+            free(dir.path);
+            return false;
+        }
+        w->dirs = tmp;
+        w->capacity = capacity;
+    }
+    w->dirs[w->count++] = (watched_dir) { wd, dir };
+
+    if(!w->recursive && !scan)
+        return true;
+
+    DIR *d = opendir(dir.path);
+    if(d == NULL)
+        return true; // Gone again already, its IN_IGNORED will clean up
+
+    bool ok = true;
+    struct dirent *entry;
+    while((entry = readdir(d)) != NULL) {
+        filepath name = { entry->d_name, strlen(entry->d_name) };
+
+        if(w->recursive && is_subdir(dir, entry))
+            ok &= add_watch(w, normalize_filepath(get_full_path(dir, name)), scan);
+        else if(scan && match_extension(entry->d_name, w->extension))
+            w->cb.func(dir, name, w->cb.args);
+    }
+    closedir(d);
+    return ok;
+}
+
+static void handle_event(watcher *w, const struct inotify_event *ev) {
+    watched_dir *dir = find_dir(w, ev->wd);
+    if(dir == NULL)
+        return;
+
+    if(ev->mask & IN_IGNORED) { // Watched directory was deleted or unmounted
+        free(dir->path.path);
+        *dir = w->dirs[--w->count];
+        return;
+    }
+    if(ev->len == 0)
+        return;
+
+    filepath path = dir->path; // dir may move when a watch is added
+    filepath name = { (char *)ev->name, strlen(ev->name) };
+
+    if(ev->mask & IN_ISDIR) {
+        if(w->recursive && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+            add_watch(w, normalize_filepath(get_full_path(path, name)), true);
+    }
+    else if((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && match_extension(name.path, w->extension))
+        w->cb.func(path, name, w->cb.args);
+}
+
+bool watch_supported(void) {
+    return true;
+}
+
+bool watch_dir(filepath root, char *extension, bool recursive, void (*ready)(void *args),
+               void (*rescan)(void *args), callback cb) {
+    watcher w = { .fd = inotify_init1(IN_CLOEXEC), .recursive = recursive, .extension = extension, .cb = cb,
+                  .dirs = NULL, .count = 0, .capacity = 0 };
+    if(w.fd < 0) {
+        printf("Cannot start inotify: %s\n", strerror(errno));
+        return false;
+    }
+
+    bool ok = (pipe2(stop_pipe, O_CLOEXEC | O_NONBLOCK) == 0) &&
+              add_watch(&w, get_full_path(root, (filepath) { "", 0 }), false);
+    if(ok) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = request_stop;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        printf("Watching %s for new files, stop with Ctrl-C\n", root.path);
+        ready(cb.args);
+    }
+
+    char *buffer = ok ? malloc(EVENT_BUFFER) : NULL;
+    struct pollfd fds[2] = { { w.fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+    ok = (buffer != NULL);
+
+    while(ok) {
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+        if(fds[1].revents) // Stop requested
+            break;
+
+        ssize_t len = read(w.fd, buffer, EVENT_BUFFER);
+        if(len < 0) {
+            if(errno == EINTR || errno == EAGAIN)
+                continue;
+            printf("Lost the inotify watch: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+
+        for(ssize_t pos = 0; pos + (ssize_t)sizeof(struct inotify_event) <= len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)&buffer[pos];
+            if(ev->mask & IN_Q_OVERFLOW) {
+                puts("Too many events at once, rescanning");
+                rescan(cb.args);
+            }
+            else
+                handle_event(&w, ev);
+            pos += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    for(size_t i = 0; i < w.count; i++)
+        free(w.dirs[i].path.path);
+    free(w.dirs);
+    free(buffer);
+    close(w.fd);
+    if(stop_pipe[0] >= 0) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+    }
+    return ok;
+}
+
+#else /* No inotify */
+
+bool watch_supported(void) {
+    return false;
+}
+
+bool watch_dir(filepath root, char *extension, bool recursive, void (*ready)(void *args),
+               void (*rescan)(void *args), callback cb) {
+    return false;
+}
+
+#endif
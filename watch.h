@@ -0,0 +1,26 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <stdbool.h>
+
+#include "filesystem_access.h"
+
+/*
+ * Long-running spool folder mode. The directory (and with recursive, every directory below it) is watched
+ * with inotify, and each file with the wanted extension is handed to the callback once the program writing
+ * it closes it (IN_CLOSE_WRITE) or it is moved in whole (IN_MOVED_TO), so no rescans are needed. Directories
+ * created or moved in later are watched as they appear, and files already in them are picked up. If the
+ * kernel's event queue overflows, events were lost and the tree is rescanned. Only available on Linux.
+ */
+
+//! Whether watch_dir() is supported on this platform
+bool watch_supported(void);
+
+//! Add the watches, call ready with cb.args once they are in place (e.g. to scan the files that are already
+//! there), then report new files until SIGINT or SIGTERM is received. rescan is called with cb.args instead
+//! of reporting the files of lost events, and should only pick up files that still need work. cb.func is
+//! called on the calling thread. Returns false if the watches could not be set up.
+bool watch_dir(filepath root, char *extension, bool recursive, void (*ready)(void *args),
+               void (*rescan)(void *args), callback cb);
+
+#endif /* WATCH_H_ */
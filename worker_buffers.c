@@ -0,0 +1,50 @@
+#include <stdlib.h>
+
+#include "system_shims.h"
+#include "encoder.h"
+#include "worker_buffers.h"
+
+typedef struct worker_state_t {
+    int32_t *scratch;
+    buffer_arena arena;
+} worker_state;
+
+struct worker_buffers_t {
+    int n_workers;
+    worker_state *workers;
+};
+
+worker_buffers *worker_buffers_create(int n_workers) {
+    worker_buffers *buffers = malloc(sizeof(worker_buffers));
+    if(buffers == NULL)
+        return NULL;
+
+    buffers->workers = calloc(n_workers, sizeof(worker_state));
+    if(buffers->workers == NULL) {
+        free(buffers);
+        return NULL;
+    }
+    buffers->n_workers = n_workers;
+    return buffers;
+}
+
+int32_t *worker_scratch(worker_buffers *buffers, int worker_id) {
+    worker_state *w = &buffers->workers[worker_id];
+    if(w->scratch == NULL)
+        w->scratch = malloc(PCM_SCRATCH_SIZE * sizeof(int32_t));
+    return w->scratch;
+}
+
+buffer_arena *worker_arena(worker_buffers *buffers, int worker_id, int frames, int block_align) {
+    buffer_arena *arena = &buffers->workers[worker_id].arena;
+    return arena_reserve(arena, frames, block_align) ? arena : NULL;
+}
+
+void worker_buffers_destroy(worker_buffers *buffers) {
+    for(int i = 0; i < buffers->n_workers; i++) {
+        free(buffers->workers[i].scratch);
+        arena_free(&buffers->workers[i].arena);
+    }
+    free(buffers->workers);
+    free(buffers);
+}
@@ -0,0 +1,28 @@
+#ifndef WORKER_BUFFERS_H_
+#define WORKER_BUFFERS_H_
+
+#include <stdint.h>
+
+#include "arena.h"
+
+/*
+ * Buffers every worker allocates on its first job and reuses for every job after it: the scratch space
+ * encode_frames() converts samples in, and the buffer arena for PCM and MP3 data. A worker only runs one
+ * job at a time, so no locks are taken.
+ */
+typedef struct worker_buffers_t worker_buffers;
+
+//! Create empty buffers for n_workers workers. Returns NULL on failure.
+worker_buffers *worker_buffers_create(int n_workers);
+
+//! worker_id's scratch space, PCM_SCRATCH_SIZE samples for encode_frames(). Returns NULL if memory runs out.
+int32_t *worker_scratch(worker_buffers *buffers, int worker_id);
+
+//! worker_id's buffer arena, grown if need be to hold frames frames of block_align bytes each and the MP3
+//! data they encode to. Returns NULL if memory runs out.
+buffer_arena *worker_arena(worker_buffers *buffers, int worker_id, int frames, int block_align);
+
+//! Free every worker's buffers
+void worker_buffers_destroy(worker_buffers *buffers);
+
+#endif /* WORKER_BUFFERS_H_ */